@@ -2,6 +2,25 @@
 
 import socket
 import select
+import struct
+import time
+
+# Binary telemetry frames (TEST;CMD=START;FORMAT=BIN): a 12 byte header followed by packed samples.
+# A binary frame always starts with a NUL byte, which never starts a text frame.
+BINARY_MARKER = 0x00
+BINARY_VERSION = 1
+BINARY_KIND_STATUS = 1
+BINARY_KIND_CHANNELS = 2  # multi-channel devices: one column per channel, channel count in the header
+BINARY_KIND_SUMMARY = 3  # AGG tests: MIN, MAX, MEAN and RMS columns per channel, column count in the header
+SUMMARY_STATS = ("_MIN", "_MAX", "", "_RMS")  # key suffixes of the summary columns; the mean keeps the plain key
+BINARY_FLAG_REPLAY = 0x01  # the frame was read back from a capture (TEST;CMD=FETCH)
+BINARY_FLAG_TIMESTAMPS = 0x02  # an i64 TS per sample follows the samples (CLOCK tests)
+BINARY_FLAG_TRANSMITTED = 0x04  # the frame ends with TX: u32 sequence, i64 time
+BINARY_TRANSMITTED = struct.Struct("<Iq")
+BINARY_HEADER = struct.Struct("<BBBBIHH")  # marker, version, kind, flags, sequence, count, reserved
+BINARY_SAMPLE = struct.Struct("<Ihh")  # time (ms), millivolts, milliamps
+
+RESEND_WINDOW = 256  # a device keeps this many of a test's latest STATUS frames for TEST;CMD=RESEND
 
 
 class DeviceClient:
@@ -25,9 +44,15 @@ class DeviceClient:
         self.port = port
         self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
         self.sock.setblocking(False)  # don't clog the pipes!
+        self.status_sock = self.sock  # replaced by a group socket for multicast devices
 
         self.device_model = None
         self.device_serial_num = None
+        self.device_channels = 1
+        self.next_seq = None  # sequence number of the next STATUS frame expected
+        self.missing_seqs = set()  # frames asked for again with RESEND
+        self.window = 0  # STATUS frames the device may send ahead of our ACKs (0 = no pacing)
+        self.acked_seq = -1  # the last STATUS frame acknowledged
 
     def send_msg(self, msg: str) -> None:
         """
@@ -42,25 +67,31 @@ class DeviceClient:
         except socket.error as err:
             print(f"Error sending message: {err}")
 
-    def receive_msg(self, buffer_size: int = 1024, timeout: int = 1) -> dict:
+    def receive_msg(
+        self, buffer_size: int = 2048, timeout: int = 1, sock: socket.socket = None
+    ) -> dict:
         """
         Receives a message from the server.
 
         Args:
             buffer_size (int): The size of the buffer to receive the message.
             timeout (int): The timeout in seconds to wait for a message.
+            sock (socket): The socket to receive from (defaults to the control socket).
 
         Returns:
             dict: A dictionary containing the message type and the message parameters.
                 If an error occurs during message retrieval or the message is invalid,
                 returns empty dictionary.
         """
-        ready_to_read, _, _ = select.select([self.sock], [], [], timeout)
+        sock = sock or self.sock
+        ready_to_read, _, _ = select.select([sock], [], [], timeout)
         if not ready_to_read:
             print("Receive timed out.")
             return {}
         try:
-            data, _ = self.sock.recvfrom(buffer_size)
+            data, _ = sock.recvfrom(buffer_size)
+            if data and data[0] == BINARY_MARKER:
+                return parse_binary_msg(data)
             msg = data.decode("ISO-8859-1")
             print("Received Message: ", msg)
             msg = msg.split(";")
@@ -89,31 +120,94 @@ class DeviceClient:
         if discover_resp and discover_resp.get("TYPE") == "ID":
             self.device_model = discover_resp["MODEL"]
             self.device_serial_num = discover_resp["SERIAL"]
+            self.device_channels = int(discover_resp.get("CHANNELS", 1))
+            if "MCAST" in discover_resp:
+                group, port = discover_resp["MCAST"].rsplit(":", 1)
+                self.join_multicast(group, int(port))
             return discover_resp["MODEL"], discover_resp["SERIAL"]
         # invalid discover response
         print("Invalid discover response from server.")
         return None
 
+    def join_multicast(self, group: str, port: int) -> None:
+        """
+        Receives status frames from the multicast group the device publishes them to.
+
+        Args:
+            group (str): The IPv4 multicast group address.
+            port (int): The port the device publishes to.
+        """
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        sock.bind((group, port))  # only this group's datagrams, shared with other listeners
+        membership = struct.pack("4s4s", socket.inet_aton(group), socket.inet_aton("0.0.0.0"))
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+        sock.setblocking(False)
+        if self.status_sock is not self.sock:
+            self.status_sock.close()
+        self.status_sock = sock
+
     def disconnect(self) -> None:
         """
-        Clears the device model and serial number and closes the socket.
+        Clears the device model and serial number and closes the sockets.
         """
         self.device_model = None
         self.device_serial_num = None
+        if self.status_sock is not self.sock:
+            self.status_sock.close()
         self.sock.close()
 
-    def start_test(self, duration: int, rate: int) -> tuple[int, str]:
+    def start_test(
+        self,
+        duration: int,
+        rate: int,
+        binary: bool = False,
+        batch: int = 1,
+        signal: str = "",
+        window: int = 0,
+        clock: str = "",
+        aggregate: int = 0,
+    ) -> tuple[int, str]:
         """
         Sends a start test command to the server.
 
         Args:
             duration (int): The duration of the test in seconds.
             rate (int): The desired test status report rate in ms.
+            binary (bool): Whether to request binary status frames instead of text.
+            batch (int): The number of samples the device packs into each status frame.
+            signal (str): Waveform to simulate, i.e. "SINE:1000" (defaults to the device's own).
+            window (int): How many STATUS frames the device may send ahead of the ones get_status
+                has returned. When this client falls behind, the device packs more samples into
+                each frame and then sends fewer readings instead of overflowing the socket.
+                0 turns pacing off.
+            clock (str): "US" or "NS" to have every block carry "TS", when each reading was
+                taken, and "TX", the kernel's transmit time of an earlier frame, in that unit
+                since the Unix epoch (see parse_status_block).
+            aggregate (int): Readings per window when the device should send only the minimum,
+                maximum, mean and RMS of each window (AGG=MINMAX). 0 sends every reading.
 
         Returns:
             tuple: A tuple containing the result code and a message describing the result.
         """
-        self.send_msg(f"TEST;CMD=START;DURATION={duration};RATE={rate};")
+        msg = f"TEST;CMD=START;DURATION={duration};RATE={rate};"
+        if binary:
+            msg += "FORMAT=BIN;"
+        if batch > 1:
+            msg += f"BATCH={batch};"
+        if signal:
+            msg += f"SIGNAL={signal};"
+        if window > 0:
+            msg += f"WINDOW={window};"
+        if clock:
+            msg += f"CLOCK={clock};"
+        if aggregate > 0:
+            msg += f"AGG=MINMAX:{aggregate};"
+        self.window = window
+        self.acked_seq = -1
+        self.next_seq = 0
+        self.missing_seqs.clear()
+        self.send_msg(msg)
         resp = self.receive_msg()
         if resp and resp.get("TYPE") == "TEST":
             if resp.get("RESULT") == "STARTED":
@@ -121,6 +215,9 @@ class DeviceClient:
             if resp.get("RESULT") == "ERROR1":
                 # ERROR1 - client tried to start a test on a device that is currently running a test
                 return 1, resp["MSG"]
+            if resp.get("RESULT") == "ERROR5":
+                # ERROR5 - the device records tests (--capture) and could not create the capture file
+                return 5, resp["MSG"]
         return -1, "Invalid response from server."
 
     def stop_test(self) -> tuple[int, str]:
@@ -134,6 +231,12 @@ class DeviceClient:
         while True:
             stop_resp = self.receive_msg()
             if stop_resp and stop_resp.get("TYPE") == "TEST":
+                if (
+                    stop_resp.get("RESULT") == "STOPPED"
+                    and self.status_sock is not self.sock
+                ):
+                    # IDLE is published to the multicast group, not sent back here
+                    return 0, "Test successfully stopped."
                 if stop_resp.get("RESULT") == "STOPPED":
                     # Get IDLE message
                     idle_resp = self.receive_msg()
@@ -159,6 +262,115 @@ class DeviceClient:
             print("Invalid response from server: ", stop_resp)
             return -1, "Invalid response from server."
 
+    def subscribe(self) -> tuple[int, str]:
+        """
+        Subscribes to the status stream of the test another client started on the device.
+
+        Returns:
+            tuple: A tuple containing the result code and a message describing the result.
+        """
+        return self._send_subscription("SUBSCRIBE", "Subscribed to test.")
+
+    def unsubscribe(self) -> tuple[int, str]:
+        """
+        Stops receiving the status stream of the running test without stopping the test.
+
+        Returns:
+            tuple: A tuple containing the result code and a message describing the result.
+        """
+        return self._send_subscription("UNSUBSCRIBE", "Unsubscribed from test.")
+
+    def _send_subscription(self, cmd: str, success_msg: str) -> tuple[int, str]:
+        self.next_seq = None  # joining mid-test: start from whichever frame comes first
+        self.window = 0  # only the client that started the test paces it
+        self.missing_seqs.clear()
+        self.send_msg(f"TEST;CMD={cmd};")
+        while True:
+            resp = self.receive_msg()
+            if resp and resp.get("TYPE") == "STATUS":
+                continue  # a status frame sent before the request was handled
+            if resp and resp.get("TYPE") == "TEST":
+                if resp.get("RESULT") == cmd + "D":
+                    return 0, success_msg
+                if resp.get("RESULT") == "ERROR2":
+                    # ERROR2 - the device is not running a test
+                    return 2, resp["MSG"]
+                if resp.get("RESULT") == "ERROR3":
+                    # ERROR3 - the test already has as many subscribers as the device allows
+                    return 3, resp["MSG"]
+            return -1, "Invalid response from server."
+
+    def fetch(self, from_ms: int, to_ms: int, binary: bool = False) -> tuple[int, dict]:
+        """
+        Reads back the readings of the last test from the device's capture (see --capture).
+
+        Args:
+            from_ms (int): The time (in ms from the start of the test) of the first reading to fetch.
+            to_ms (int): The time (in ms) of the last reading to fetch.
+            binary (bool): Whether the readings are sent as binary frames.
+
+        Returns:
+            tuple: The result code and the readings as one block (see parse_status_block).
+                Readings the device lost during the test are missing from the block.
+        """
+        block = {
+            "TIME": [],
+            "MV": [[] for _ in range(self.device_channels)],
+            "MA": [[] for _ in range(self.device_channels)],
+        }
+        fmt = "FORMAT=BIN;" if binary else ""
+        while True:
+            self.send_msg(f"TEST;CMD=FETCH;FROM={from_ms};TO={to_ms};{fmt}")
+            while True:
+                resp = self.receive_msg()
+                if resp and resp.get("TYPE") == "STATUS":
+                    if not resp.get("REPLAY"):
+                        continue  # a live status frame of a running test
+                    part = resp.get("BLOCK") or parse_status_block(resp, self.device_channels)
+                    block["TIME"] += part["TIME"]
+                    for c in range(self.device_channels):
+                        block["MV"][c] += part["MV"][c]
+                        block["MA"][c] += part["MA"][c]
+                    continue
+                if resp and resp.get("TYPE") == "TEST":
+                    if resp.get("RESULT") == "ERROR4":
+                        # ERROR4 - the device has not captured a test
+                        return 4, block
+                    if resp.get("RESULT") == "FETCHED":
+                        break
+                return -1, block
+            if "NEXT" not in resp:
+                return 0, block
+            from_ms = int(resp["NEXT"])
+
+    def get_stats(self) -> dict:
+        """
+        Asks the device for its metrics (see STATS in the ReadMe).
+
+        Returns:
+            dict: Each counter as an int, and each timing ("TICK_JITTER_NS", "ENCODE_NS",
+                "SEND_NS") as a dictionary with "count", "p50", "p99", "p999" and "max" in ns.
+                If the device does not answer, returns empty dictionary.
+        """
+        self.send_msg("STATS;")
+        while True:
+            resp = self.receive_msg()
+            if not resp:
+                return {}
+            if resp.get("TYPE") == "STATS":
+                break  # anything else is status traffic of a running test
+        stats = {}
+        for key, value in resp.items():
+            if key == "TYPE":
+                continue
+            if "," in value:
+                stats[key] = dict(
+                    zip(["count", "p50", "p99", "p999", "max"], map(int, value.split(",")))
+                )
+            else:
+                stats[key] = int(value)
+        return stats
+
     def get_status(self) -> dict:
         """
         Receives a status message from the server.
@@ -166,13 +378,203 @@ class DeviceClient:
         Returns:
             dict: A dictionary containing the device status and message:
                 - If status = IDLE, message = "No test running."
-                - If status = TESTING, message = time, voltage, and current values.
+                - If status = TESTING, message = a block of samples, see parse_status_block.
                 - if status is neither, returns None.
         """
-        msg = self.receive_msg()
+        sock = self.status_sock
+        if self.missing_seqs and sock is not self.sock:
+            # resent frames come back to the control socket, not the multicast group
+            ready_to_read, _, _ = select.select([self.sock], [], [], 0)
+            if ready_to_read:
+                sock = self.sock
+        msg = self.receive_msg(sock=sock)
+        if msg and msg.get("TYPE") == "TEST" and msg.get("RESULT") == "RESENT":
+            # every frame the device still had has arrived; give up on the others
+            self.missing_seqs.clear()
+            msg = self.receive_msg(sock=self.status_sock)
         if msg and msg.get("TYPE") == "STATUS":
             if msg.get("STATE") == "IDLE":
                 print("Test has ended.")
                 return {"state": "IDLE", "msg": "No test running."}
-            return {"state": "TESTING", "msg": (msg["TIME"], msg["MV"], msg["MA"])}
+            if "SEQ" in msg and not self._track_sequence(int(msg["SEQ"])):
+                empty = [[] for _ in range(self.device_channels)]
+                return {"state": "TESTING", "msg": {"TIME": [], "MV": empty, "MA": empty}}
+            if "BLOCK" in msg:
+                return {"state": "TESTING", "msg": msg["BLOCK"]}
+            return {"state": "TESTING", "msg": parse_status_block(msg, self.device_channels)}
         return None
+
+    def _track_sequence(self, seq: int) -> bool:
+        """
+        Notes the arrival of STATUS frame seq, asks the device to resend any frames skipped and,
+        when the test is paced, acknowledges the frames received so far.
+
+        Returns:
+            bool: False if the frame had already arrived.
+        """
+        if seq in self.missing_seqs:
+            self.missing_seqs.discard(seq)
+            return True
+        if self.next_seq is not None and seq < self.next_seq:
+            return False
+        if self.next_seq is not None and seq > self.next_seq:
+            first = max(self.next_seq, seq - RESEND_WINDOW)
+            self.send_msg(f"TEST;CMD=RESEND;FROM={first};TO={seq - 1};")
+            self.missing_seqs.update(range(first, seq))
+        self.next_seq = seq + 1
+        if self.window and self.next_seq - 1 - self.acked_seq >= max(1, self.window // 4):
+            self.acked_seq = self.next_seq - 1
+            self.send_msg(f"TEST;CMD=ACK;SEQ={self.acked_seq};")
+        return True
+
+
+def parse_binary_msg(data: bytes) -> dict:
+    """
+    Decodes a binary telemetry frame.
+
+    Args:
+        data (bytes): The received datagram, starting with the binary marker.
+
+    Returns:
+        dict: A dictionary with TYPE "STATUS", the frame sequence number under "SEQ" and the
+            samples under "BLOCK" (see parse_status_block); frames read back from a capture
+            also have "REPLAY".
+            If the frame is malformed, returns empty dictionary.
+    """
+    if len(data) < BINARY_HEADER.size:
+        print("Invalid binary message received.")
+        return {}
+    _, version, kind, flags, sequence, count, channels = BINARY_HEADER.unpack_from(data)
+    if kind == BINARY_KIND_STATUS:
+        channels = 1
+        samples_end = BINARY_HEADER.size + count * BINARY_SAMPLE.size
+    else:
+        samples_end = BINARY_HEADER.size + count * (4 + 4 * channels)
+    end = samples_end
+    if flags & BINARY_FLAG_TIMESTAMPS:
+        end += 8 * count
+    if flags & BINARY_FLAG_TRANSMITTED:
+        end += BINARY_TRANSMITTED.size
+    if (
+        version != BINARY_VERSION
+        or kind not in (BINARY_KIND_STATUS, BINARY_KIND_CHANNELS, BINARY_KIND_SUMMARY)
+        or channels == 0
+        or len(data) < end
+    ):
+        print("Invalid binary message received.")
+        return {}
+
+    if kind == BINARY_KIND_STATUS:
+        samples = list(BINARY_SAMPLE.iter_unpack(data[BINARY_HEADER.size : samples_end]))
+        block = {
+            "TIME": [time_ms / 1000 for time_ms, _, _ in samples],
+            "MV": [[mv for _, mv, _ in samples]],
+            "MA": [[ma for _, _, ma in samples]],
+        }
+    else:
+        times = struct.unpack_from(f"<{count}I", data, BINARY_HEADER.size)
+        values = struct.unpack_from(
+            f"<{2 * channels * count}h", data, BINARY_HEADER.size + 4 * count
+        )
+        columns = [
+            list(values[c * count : (c + 1) * count]) for c in range(2 * channels)
+        ]
+        block = {"TIME": [t / 1000 for t in times]}
+        stats = SUMMARY_STATS if kind == BINARY_KIND_SUMMARY else ("",)
+        for quantity, first in (("MV", 0), ("MA", channels)):
+            for s, suffix in enumerate(stats):
+                block[quantity + suffix] = columns[first + s : first + channels : len(stats)]
+    if flags & BINARY_FLAG_TIMESTAMPS:
+        block["TS"] = list(struct.unpack_from(f"<{count}q", data, samples_end))
+    if flags & BINARY_FLAG_TRANSMITTED:
+        block["TX"] = BINARY_TRANSMITTED.unpack_from(data, end - BINARY_TRANSMITTED.size)
+    msg = {"TYPE": "STATUS", "SEQ": sequence, "BLOCK": block}
+    if flags & BINARY_FLAG_REPLAY:
+        msg["REPLAY"] = "1"
+    return msg
+
+
+def parse_status_block(msg: dict, channels: int) -> dict:
+    """
+    Collects the samples of a text STATUS frame into a block.
+
+    Args:
+        msg (dict): The parsed text frame, with comma separated TIME, MV and MA lists
+            (MV0, MA0, MV1, ... on devices with more than one channel).
+        channels (int): The number of channels the device reported.
+
+    Returns:
+        dict: The block: "TIME" is the list of sample times in seconds, and "MV" and "MA" hold
+            one list of readings per channel, each as long as "TIME". In a summary (AGG test),
+            they are the window means, and "MV_MIN", "MV_MAX", "MV_RMS" and the "MA_" lists
+            of the same shape hold the other statistics. Frames of a test started
+            with a clock also have "TS", the time each reading was taken, and may have "TX", a
+            (sequence, time) pair giving when the device's kernel sent an earlier frame.
+    """
+    keys = [""] if channels == 1 else [str(c) for c in range(channels)]
+    stats = SUMMARY_STATS if "MV" + keys[0] + "_MIN" in msg else ("",)
+    block = {"TIME": [float(t) for t in msg["TIME"].split(",")]}
+    for quantity in ("MV", "MA"):
+        for suffix in stats:
+            block[quantity + suffix] = [
+                [int(v) for v in msg[quantity + k + suffix].split(",")] for k in keys
+            ]
+    if "TS" in msg:
+        block["TS"] = [int(t) for t in msg["TS"].split(",")]
+    if "TX" in msg:
+        sequence, sent = msg["TX"].split(",")
+        block["TX"] = (int(sequence), int(sent))
+    return block
+
+
+def scan_devices(
+    discovery_port: int,
+    address: str = "255.255.255.255",
+    jitter_ms: int = 200,
+    timeout: float = 0.3,
+) -> list[dict]:
+    """
+    Finds every device answering scans on the discovery port in one round trip.
+
+    Args:
+        discovery_port (int): The port the devices were given with --discovery.
+        address (str): Where to send the scan: a broadcast address or the devices' multicast group.
+            A unicast address reaches only one device process on that host.
+        jitter_ms (int): The window (in ms) over which devices spread their replies.
+        timeout (float): How long to keep listening (in seconds) once the window has passed.
+
+    Returns:
+        list: One dictionary per device that replied, with its "IP", "PORT", "MODEL" and
+            "SERIAL", in the order the replies arrived.
+    """
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 1 << 20)  # room for a fleet's replies
+    sock.setblocking(False)
+    found = {}
+    try:
+        sock.sendto(f"ID;JITTER={jitter_ms};".encode("ISO-8859-1"), (address, discovery_port))
+        deadline = time.monotonic() + jitter_ms / 1000 + timeout
+        while True:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                break
+            ready_to_read, _, _ = select.select([sock], [], [], remaining)
+            if not ready_to_read:
+                break
+            data, (ip, port) = sock.recvfrom(2048)
+            fields = data.decode("ISO-8859-1").split(";")
+            if fields[0] != "ID":
+                continue
+            reply = {f.split("=")[0]: f.split("=")[1] for f in fields if "=" in f}
+            found[(ip, port)] = {
+                "IP": ip,
+                "PORT": port,
+                "MODEL": reply.get("MODEL"),
+                "SERIAL": reply.get("SERIAL"),
+            }
+    except socket.error as err:
+        print(f"Error scanning for devices: {err}")
+    finally:
+        sock.close()
+    return list(found.values())
@@ -101,19 +101,22 @@ class SelectedDevice(QWidget):
         )
         self.disconnect_device()
 
-    def start_device_test(self, test_duration: float, rate: float) -> bool:
+    def start_device_test(
+        self, test_duration: float, rate: float, batch: int = 1
+    ) -> bool:
         """Starts testing the connected device.
 
         Args:
             test_duration (float): The duration of the test in seconds.
             rate (float): The rate of the test in ms.
+            batch (int): The number of samples per status frame.
 
         Returns:
             bool: True if the test was started successfully, otherwise False.
         """
 
         # Start the test
-        response = self.connected_device.start_test(test_duration, rate)
+        response = self.connected_device.start_test(test_duration, rate, batch=batch)
         if response[0] == -1:
             # device has been disconnected
             self.device_not_responding()
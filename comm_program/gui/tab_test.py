@@ -30,13 +30,14 @@ from PyQt5.QtChart import (
     QAbstractAxis,
     QAbstractSeries,
 )
-from PyQt5.QtCore import Qt, QObject, QTimer
+from PyQt5.QtCore import Qt, QObject, QTimer, QPointF
 
 if TYPE_CHECKING:
     from comm_program.gui.selected_device import SelectedDevice
 
 
 TEST_RATE = 250  # ms
+TEST_BATCH = 1  # samples per status frame
 
 
 class TestTab(QWidget):
@@ -54,8 +55,9 @@ class TestTab(QWidget):
         self.run_test_button = device.run_test_button
         self.run_test_button.setEnabled(False)
 
-        self.mv_series = QLineSeries()
-        self.ma_series = QLineSeries()
+        # one series per device channel
+        self.mv_series = [QLineSeries()]
+        self.ma_series = [QLineSeries()]
 
         self.worker = None
 
@@ -105,12 +107,9 @@ class TestTab(QWidget):
         self.ma_chart = QChart()
         self.ma_chart.legend().hide()
 
-        self.mv_chart.addSeries(self.mv_series)
-        self.ma_chart.addSeries(self.ma_series)
-
         axis_titles = [("Time (s)", "Millivolts"), ("Time (s)", "Milliamps")]
 
-        for chart, series, titles in zip(
+        for chart, series_list, titles in zip(
             [self.mv_chart, self.ma_chart],
             [self.mv_series, self.ma_series],
             axis_titles,
@@ -120,8 +119,10 @@ class TestTab(QWidget):
             axis_y.setTitleText(titles[1])
             chart.addAxis(axis_x, Qt.AlignBottom)
             chart.addAxis(axis_y, Qt.AlignLeft)
-            series.attachAxis(axis_x)
-            series.attachAxis(axis_y)
+            for series in series_list:
+                chart.addSeries(series)
+                series.attachAxis(axis_x)
+                series.attachAxis(axis_y)
 
         # Set chart titles
         self.mv_chart.setTitle("Millivolt Test Metrics")
@@ -169,11 +170,12 @@ class TestTab(QWidget):
             and self.test_duration_input.text() != ""
         ):
             # clear series
-            self.mv_series.clear()
-            self.ma_series.clear()
-            self.worker = Worker(self, TEST_RATE)
+            self.set_channel_count(self.device.connected_device.device_channels)
+            for series in self.mv_series + self.ma_series:
+                series.clear()
+            self.worker = Worker(self, TEST_RATE * TEST_BATCH)
             success = self.device.start_device_test(
-                float(self.test_duration_input.text()), TEST_RATE
+                float(self.test_duration_input.text()), TEST_RATE, TEST_BATCH
             )
             if success:
                 self.worker.start()
@@ -194,17 +196,55 @@ class TestTab(QWidget):
                 self.worker = None
                 self.run_test_button.setText("Run Test")
 
-    def update_plots(self, time: float, mv: float, ma: float) -> None:
+    def set_channel_count(self, channels: int) -> None:
+        """Add or remove series so that each chart plots one series per device channel.
+
+        Args:
+            channels (int): The number of channels of the connected device.
+        """
+        for chart, series_list in [
+            (self.mv_chart, self.mv_series),
+            (self.ma_chart, self.ma_series),
+        ]:
+            while len(series_list) > channels:
+                chart.removeSeries(series_list.pop())
+            while len(series_list) < channels:
+                series = QLineSeries()
+                chart.addSeries(series)
+                series.attachAxis(chart.axes()[0])
+                series.attachAxis(chart.axes()[1])
+                series_list.append(series)
+            for index, series in enumerate(series_list):
+                series.setName(f"Channel {index}")
+            if channels > 1:
+                chart.legend().show()
+            else:
+                chart.legend().hide()
+
+    def update_plots(self, block: dict) -> None:
         """Update the plots with new data.
 
         Args:
-            time (float): The time in seconds.
-            mv (float): The millivolt value.
-            ma (float): The milliamp value.
+            block (dict): The samples to append: "TIME" in seconds, and "MV" and "MA" holding
+                one list of readings per channel.
         """
         self.save_button.setEnabled(True)
-        self.mv_series.append(float(time), float(mv))
-        self.ma_series.append(float(time), float(ma))
+        times = block["TIME"]
+        for series_list, columns in [
+            (self.mv_series, block["MV"]),
+            (self.ma_series, block["MA"]),
+        ]:
+            # append each channel's column in one call rather than point by point
+            for series, values in zip(series_list, columns):
+                points = [QPointF(t, v) for t, v in zip(times, values)]
+                count = series.count()
+                if points and count and points[0].x() < series.at(count - 1).x():
+                    # a resent frame filling an earlier gap
+                    merged = series.pointsVector() + points
+                    merged.sort(key=QPointF.x)
+                    series.replace(merged)
+                else:
+                    series.append(points)
         update_axis_range(
             self.mv_series, self.mv_chart.axes()[0], self.mv_chart.axes()[1]
         )
@@ -357,7 +397,7 @@ class Worker(QObject):
             return
         self.consecutive_timeout_responses = 0
         if status.get("state") == "TESTING":
-            self.update_plot_func(*status["msg"])
+            self.update_plot_func(status["msg"])
         elif status.get("state") == "IDLE":
             self.stop()
         else:
@@ -365,16 +405,18 @@ class Worker(QObject):
 
 
 def update_axis_range(
-    series: QAbstractSeries, axis_x: QValueAxis, axis_y: QValueAxis
+    series_list: list[QAbstractSeries], axis_x: QValueAxis, axis_y: QValueAxis
 ) -> None:
-    """Update the range of an axis based on the range of a series
+    """Update the range of an axis based on the range of a list of series
 
     Args:
-        series (QAbstractSeries): The series to use to update the axis range.
+        series_list (list): The series to use to update the axis range.
         axis_x (QValueAxis): The X axis to update.
         axis_y (QValueAxis): The Y axis to update.
     """
-    points = series.pointsVector()
+    points = [point for series in series_list for point in series.pointsVector()]
+    if not points:
+        return
     xs, ys = zip(*[(point.x(), point.y()) for point in points])
     axis_x.setRange(min(xs), max(xs))
     axis_y.setRange(min(ys), max(ys))
@@ -502,17 +544,17 @@ def qline_series_to_list(series: QLineSeries) -> list[tuple[float, float]]:
     return points_list
 
 
-def analyze_data(series: QLineSeries) -> dict[str, float]:
-    """Analyze the data from a test.
+def analyze_data(series_list: list[QLineSeries]) -> dict[str, float]:
+    """Analyze the data from a test, across every channel.
 
     Args:
-        series (QLineSeries): The series containing the data to analyze.
+        series_list (list): The series (one per channel) containing the data to analyze.
 
     Returns:
         dict: A dictionary containing the analysis results.
     """
-    points_list = qline_series_to_list(series)
-    values = [y for _, y in points_list]
+    points_list = qline_series_to_list(series_list[0])
+    values = [y for series in series_list for _, y in qline_series_to_list(series)]
     duration = points_list[-1][0] - points_list[0][0]
 
     return {
@@ -1,306 +1,5028 @@
 // Required libraries
 #include <iostream>
 #include <string>
-#include <sstream>
-#include <map>
-#include <thread>
+#include <string_view>
+#include <charconv>
+#include <cstring>
+#include <climits>
 #include <chrono>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <pthread.h>
 #include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <fstream>
+#include <cstdio>
+#include <cstdarg>
+#include <ctime>
+
+// Sample is one timestamped reading of every channel, tagged with the test (generation) it was taken for.
+// The channel values themselves live beside it in the SampleQueue slot it occupies.
+struct Sample
+{
+    int64_t time_ms;     // offset from the start of the test
+    int64_t taken_ns;    // when the sampler actually took the reading, see realtime_ns()
+    uint32_t generation;
+    bool last;           // end-of-test marker: no reading, the test's duration has elapsed
+};
+
+// Nanoseconds since the Unix epoch on CLOCK_REALTIME, the clock the kernel's SO_TIMESTAMPING stamps
+// use, so that timestamps taken by different devices and by the kernel line up
+int64_t realtime_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// SpscRing is a bounded lock-free single-producer/single-consumer queue. One thread may push and
+// one other thread may pop; neither ever blocks or takes a lock.
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert((N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    // Producer side: appends value; returns false (dropping it) if the ring is full
+    bool push(const T &value)
+    {
+        T *slot = claim();
+        if (slot == nullptr)
+        {
+            return false;
+        }
+        *slot = value;
+        publish();
+        return true;
+    }
+
+    // Consumer side: removes the oldest value into out; returns false if the ring is empty
+    bool pop(T &out)
+    {
+        const T *slot = front();
+        if (slot == nullptr)
+        {
+            return false;
+        }
+        out = *slot;
+        release();
+        return true;
+    }
+
+    // Producer side, in place: the next free slot (nullptr if the ring is full), filled by the caller
+    // and handed to the consumer with publish()
+    T *claim()
+    {
+        size_t tail = this->tail_.load(std::memory_order_relaxed);
+        if (tail - this->head_.load(std::memory_order_acquire) == N)
+        {
+            return nullptr;
+        }
+        return &this->slots_[tail & (N - 1)];
+    }
+
+    void publish() { this->tail_.store(this->tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // Consumer side, in place: the oldest slot (nullptr if the ring is empty), readable until release()
+    const T *front() const
+    {
+        size_t head = this->head_.load(std::memory_order_relaxed);
+        if (head == this->tail_.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        return &this->slots_[head & (N - 1)];
+    }
+
+    void release() { this->head_.store(this->head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // Position of a slot returned by claim() or front(), for storage kept alongside the ring
+    size_t index_of(const T *slot) const { return static_cast<size_t>(slot - this->slots_); }
+
+private:
+    // Member variables, producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<size_t> head_{0}; // written by the consumer
+    alignas(64) std::atomic<size_t> tail_{0}; // written by the producer
+    T slots_[N];
+};
+
+// Per-packet trace lines (every request received and frame sent) are compiled in unless the build
+// sets DEVICE_TRACE_PACKETS=0 (make TRACE=0), which removes them and their formatting entirely.
+#ifndef DEVICE_TRACE_PACKETS
+#define DEVICE_TRACE_PACKETS 1
+#endif
+
+enum class LogLevel
+{
+    Trace,
+    Info,
+    Warn,
+    Error
+};
+
+// Logger hands log lines to a background writer thread, so that logging from the event loops costs
+// one formatted copy into a lock-free queue instead of a terminal write and flush. Any thread may
+// log. Lines that find the queue full are dropped and counted, never waited for. Trace lines are
+// additionally limited to a number per second; the writer reports how many were left out.
+class Logger
+{
+public:
+    static constexpr size_t kLineSize = 240; // longer lines, such as large STATUS frames, are cut short
+    static constexpr size_t kQueueLines = 4096;
+
+    static Logger &instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    // Lines below level are not logged
+    void set_level(LogLevel level) { this->level_.store(level, std::memory_order_relaxed); }
+
+    // At most lines_per_second trace lines are logged each second (0 = no limit)
+    void set_trace_rate(uint32_t lines_per_second) { this->trace_rate_.store(lines_per_second, std::memory_order_relaxed); }
+
+    bool enabled(LogLevel level) const { return level >= this->level_.load(std::memory_order_relaxed); }
+
+    // True if a trace line may be logged now; counts the ones the rate limit leaves out
+    bool trace_allowed()
+    {
+        if (!enabled(LogLevel::Trace))
+        {
+            return false;
+        }
+        uint32_t rate = this->trace_rate_.load(std::memory_order_relaxed);
+        if (rate == 0)
+        {
+            return true;
+        }
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+        int64_t second = now.tv_sec;
+        if (this->trace_second_.load(std::memory_order_relaxed) != second &&
+            this->trace_second_.exchange(second, std::memory_order_relaxed) != second)
+        {
+            this->trace_count_.store(0, std::memory_order_relaxed);
+        }
+        if (this->trace_count_.fetch_add(1, std::memory_order_relaxed) < rate)
+        {
+            return true;
+        }
+        this->suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Formats a line straight into a queue slot (printf conventions; the newline is added)
+    void write(LogLevel level, const char *format, ...) __attribute__((format(printf, 3, 4)))
+    {
+        size_t position = this->tail_.load(std::memory_order_relaxed);
+        Line *line;
+        for (;;)
+        {
+            line = &this->lines_[position % kQueueLines];
+            size_t ready = line->sequence.load(std::memory_order_acquire);
+            if (ready == position)
+            {
+                if (this->tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (ready < position)
+            {
+                this->dropped_.fetch_add(1, std::memory_order_relaxed); // full: the writer is behind
+                return;
+            }
+            else
+            {
+                position = this->tail_.load(std::memory_order_relaxed);
+            }
+        }
+
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(line->text, kLineSize, format, args);
+        va_end(args);
+        line->length = length < 0 ? 0 : (static_cast<size_t>(length) < kLineSize ? static_cast<size_t>(length) : kLineSize - 1);
+        line->level = level;
+        line->sequence.store(position + 1, std::memory_order_release);
+
+        if (this->writer_idle_.exchange(false, std::memory_order_acq_rel))
+        {
+            this->wake_.notify_one();
+        }
+    }
+
+private:
+    struct Line
+    {
+        std::atomic<size_t> sequence; // == position: free for the producer of position; == position + 1: ready
+        LogLevel level;
+        size_t length;
+        char text[kLineSize];
+    };
+
+    // Member variables
+    std::unique_ptr<Line[]> lines_;
+    alignas(64) std::atomic<size_t> tail_{0}; // next position a producer claims
+    alignas(64) size_t head_ = 0;             // next position the writer reads, writer thread only
+    std::atomic<LogLevel> level_{LogLevel::Trace};
+    std::atomic<uint32_t> trace_rate_{1000};
+    std::atomic<int64_t> trace_second_{0};
+    std::atomic<uint32_t> trace_count_{0};
+    std::atomic<uint64_t> suppressed_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<bool> writer_idle_{false};
+    std::atomic<bool> stopping_{false};
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::thread writer_;
+    std::chrono::steady_clock::time_point last_report_; // writer thread only
+
+    Logger() : lines_(new Line[kQueueLines])
+    {
+        for (size_t i = 0; i < kQueueLines; i++)
+        {
+            this->lines_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        this->writer_ = std::thread([this]
+                                    { this->run(); });
+    }
+
+    ~Logger()
+    {
+        this->stopping_.store(true, std::memory_order_release);
+        this->wake_.notify_one();
+        this->writer_.join();
+    }
+
+    // Writer thread: copies lines out in order, flushing whenever the queue runs dry
+    void run()
+    {
+        for (;;)
+        {
+            bool wrote = false;
+            for (;;)
+            {
+                Line &line = this->lines_[this->head_ % kQueueLines];
+                if (line.sequence.load(std::memory_order_acquire) != this->head_ + 1)
+                {
+                    break;
+                }
+                FILE *out = line.level >= LogLevel::Warn ? stderr : stdout;
+                fwrite(line.text, 1, line.length, out);
+                fputc('\n', out);
+                line.sequence.store(this->head_ + kQueueLines, std::memory_order_release);
+                this->head_++;
+                wrote = true;
+            }
+            report_losses();
+            if (wrote)
+            {
+                fflush(stdout);
+                continue;
+            }
+            if (this->stopping_.load(std::memory_order_acquire))
+            {
+                return;
+            }
+
+            // a producer that sees writer_idle_ set wakes us; the timeout covers a line published
+            // between the check above and setting the flag
+            this->writer_idle_.store(true, std::memory_order_release);
+            std::unique_lock<std::mutex> lock(this->wake_mutex_);
+            this->wake_.wait_for(lock, std::chrono::milliseconds{50});
+        }
+    }
+
+    // Reports the lines left out, at most once a second (and once more when stopping)
+    void report_losses()
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (now - this->last_report_ < std::chrono::seconds{1} && !this->stopping_.load(std::memory_order_acquire))
+        {
+            return;
+        }
+        this->last_report_ = now;
+        uint64_t suppressed = this->suppressed_.exchange(0, std::memory_order_relaxed);
+        uint64_t dropped = this->dropped_.exchange(0, std::memory_order_relaxed);
+        if (suppressed != 0)
+        {
+            fprintf(stdout, "(%llu trace lines over the rate limit were not logged)\n", static_cast<unsigned long long>(suppressed));
+        }
+        if (dropped != 0)
+        {
+            fprintf(stderr, "(%llu log lines were dropped: log queue full)\n", static_cast<unsigned long long>(dropped));
+        }
+    }
+};
+
+// Logging macros: the arguments are only evaluated when the line will actually be logged
+#define LOG_AT(level, ...)                                \
+    do                                                    \
+    {                                                     \
+        if (Logger::instance().enabled(level))            \
+        {                                                 \
+            Logger::instance().write(level, __VA_ARGS__); \
+        }                                                 \
+    } while (0)
+#define LOG_INFO(...) LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LogLevel::Warn, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LogLevel::Error, __VA_ARGS__)
+#if DEVICE_TRACE_PACKETS
+#define LOG_TRACE(...)                                              \
+    do                                                              \
+    {                                                               \
+        if (Logger::instance().trace_allowed())                     \
+        {                                                           \
+            Logger::instance().write(LogLevel::Trace, __VA_ARGS__); \
+        }                                                           \
+    } while (0)
+#else
+#define LOG_TRACE(...) \
+    do                 \
+    {                  \
+    } while (0)
+#endif
+
+// Histogram counts durations in nanoseconds into log-linear buckets, HDR style: exact below 16 ns,
+// then 8 buckets per power of two, so any quantile it reports is within 12.5% of the true value.
+// Any thread may record; reads are approximate while records are in flight.
+class Histogram
+{
+public:
+    static constexpr size_t kBuckets = 16 + 60 * 8;
+
+    void record(int64_t nanos)
+    {
+        uint64_t value = nanos < 0 ? 0 : static_cast<uint64_t>(nanos);
+        this->buckets_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        this->count_.fetch_add(1, std::memory_order_relaxed);
+        uint64_t max = this->max_.load(std::memory_order_relaxed);
+        while (value > max && !this->max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void clear()
+    {
+        for (auto &bucket : this->buckets_)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        this->count_.store(0, std::memory_order_relaxed);
+        this->max_.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return this->count_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return this->max_.load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket holding the quantile q (0..1) of the recorded values; 0 if none
+    uint64_t quantile(double q) const
+    {
+        uint64_t total = count();
+        if (total == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; i++)
+        {
+            seen += this->buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+            {
+                uint64_t upper = upper_bound(i);
+                return upper < max() ? upper : max();
+            }
+        }
+        return max();
+    }
+
+private:
+    // Member variables
+    std::atomic<uint64_t> buckets_[kBuckets] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> max_{0};
+
+    static size_t bucket_of(uint64_t value)
+    {
+        if (value < 16)
+        {
+            return static_cast<size_t>(value);
+        }
+        int exponent = 63 - __builtin_clzll(value); // >= 4
+        size_t sub = static_cast<size_t>(value >> (exponent - 3)) & 7;
+        return 16 + static_cast<size_t>(exponent - 4) * 8 + sub;
+    }
+
+    static uint64_t upper_bound(size_t bucket)
+    {
+        if (bucket < 16)
+        {
+            return bucket;
+        }
+        int exponent = static_cast<int>((bucket - 16) / 8) + 4;
+        uint64_t sub = (bucket - 16) % 8;
+        return ((8 + sub + 1) << (exponent - 3)) - 1;
+    }
+};
+
+// SendMetrics counts what every event loop in the process hands to the kernel (STATS reports it)
+struct SendMetrics
+{
+    std::atomic<uint64_t> datagrams{0}; // accepted by sendmmsg
+    std::atomic<uint64_t> failed{0};    // rejected by sendmmsg and dropped
+    std::atomic<uint64_t> dropped{0};   // not sent because the socket's send buffer was full
+    std::atomic<uint64_t> partial{0};   // accepted but cut short
+    Histogram call_time;                // duration of each sendmmsg call
+
+    static SendMetrics &instance()
+    {
+        static SendMetrics metrics;
+        return metrics;
+    }
+};
+
+// MeasurementRng is a counter-based generator: output i of a stream is SplitMix64 applied to
+// key + i * gamma. Every output depends only on the seed and its index, so the generator has no
+// shared state, a stream is reproducible from its seed, and filling a block is a branch-free loop
+// the compiler can vectorize.
+class MeasurementRng
+{
+public:
+    explicit MeasurementRng(uint64_t seed) : key_(mix(seed)) {}
+
+    uint64_t next() { return mix(this->key_ + this->counter_++ * kGamma); }
+
+    // Fills out[0, count) with uniform integers in [low, low + range), exactly as count calls to next() would
+    void fill_uniform(int32_t *out, size_t count, int32_t low, uint32_t range)
+    {
+        uint64_t base = this->counter_;
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t r = mix(this->key_ + (base + i) * kGamma);
+            out[i] = low + static_cast<int32_t>(((r >> 32) * range) >> 32); // multiply-shift range reduction
+        }
+        this->counter_ += count;
+    }
+
+private:
+    static constexpr uint64_t kGamma = 0x9e3779b97f4a7c15ULL;
+
+    // Member variables
+    uint64_t key_;
+    uint64_t counter_ = 0;
+
+    static uint64_t mix(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+};
+
+// SignalModel is a pluggable waveform for simulated readings. generate() fills whole blocks of
+// noiseless levels at once; implementations keep their loops branch-free so the compiler can
+// vectorize them. Uniform noise of the model's half-widths is added on top by the Device.
+class SignalModel
+{
+public:
+    virtual ~SignalModel() = default;
+
+    // Name reported in the ID response
+    virtual std::string_view name() const = 0;
+
+    // Writes the millivolt and milliamp levels at time_ms[0, count) into the output arrays
+    virtual void generate(const double *time_ms, size_t count, double *millivolts, double *milliamps) const = 0;
+
+    int32_t millivolts_noise() const { return this->millivolts_noise_; }
+    int32_t milliamps_noise() const { return this->milliamps_noise_; }
+
+protected:
+    SignalModel(int32_t millivolts_noise, int32_t milliamps_noise)
+        : millivolts_noise_(millivolts_noise), milliamps_noise_(milliamps_noise) {}
+
+    // Sine without a libm call: wrap to [-pi, pi], fold to [-pi/2, pi/2], then a degree-9 Taylor polynomial
+    static double fast_sin(double x)
+    {
+        constexpr double kPi = 3.14159265358979323846;
+        x -= std::floor(x * (0.5 / kPi) + 0.5) * (2.0 * kPi);
+        double y = x > 0.5 * kPi ? kPi - x : (x < -0.5 * kPi ? -kPi - x : x);
+        double y2 = y * y;
+        return y * (1.0 + y2 * (-1.0 / 6 + y2 * (1.0 / 120 + y2 * (-1.0 / 5040 + y2 * (1.0 / 362880)))));
+    }
+
+    // Position of t within a repeating period, as a fraction in [0, 1)
+    static double phase(double t, double period)
+    {
+        double cycles = t / period;
+        return cycles - std::floor(cycles);
+    }
+
+private:
+    int32_t millivolts_noise_;
+    int32_t milliamps_noise_;
+};
+
+// NOISE: uniform readings between 1800 and 5000 mV and between 0 and 100 mA (the default)
+class NoiseSignal : public SignalModel
+{
+public:
+    NoiseSignal() : SignalModel(1600, 50) {}
+    std::string_view name() const override { return "NOISE"; }
+    void generate(const double *, size_t count, double *millivolts, double *milliamps) const override
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            millivolts[i] = 3400.0;
+            milliamps[i] = 50.0;
+        }
+    }
+};
+
+// SINE[:period_ms]: voltage and current oscillating around 3400 mV / 50 mA
+class SineSignal : public SignalModel
+{
+public:
+    explicit SineSignal(double period_ms) : SignalModel(20, 2), period_ms_(period_ms) {}
+    std::string_view name() const override { return "SINE"; }
+    void generate(const double *time_ms, size_t count, double *millivolts, double *milliamps) const override
+    {
+        const double omega = 2.0 * 3.14159265358979323846 / this->period_ms_;
+        for (size_t i = 0; i < count; i++)
+        {
+            double wave = fast_sin(omega * time_ms[i]);
+            millivolts[i] = 3400.0 + 1500.0 * wave;
+            milliamps[i] = 50.0 + 45.0 * wave;
+        }
+    }
+
+private:
+    double period_ms_;
+};
+
+// RAMP[:period_ms]: sawtooth sweeping 1800 to 5000 mV and 0 to 100 mA every period
+class RampSignal : public SignalModel
+{
+public:
+    explicit RampSignal(double period_ms) : SignalModel(10, 1), period_ms_(period_ms) {}
+    std::string_view name() const override { return "RAMP"; }
+    void generate(const double *time_ms, size_t count, double *millivolts, double *milliamps) const override
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            double fraction = phase(time_ms[i], this->period_ms_);
+            millivolts[i] = 1800.0 + 3200.0 * fraction;
+            milliamps[i] = 100.0 * fraction;
+        }
+    }
+
+private:
+    double period_ms_;
+};
+
+// BATTERY[:discharge_ms]: a cell discharging under constant load from 4200 mV to its 3000 mV cut-off,
+// flat through the middle and dropping off sharply near empty
+class BatterySignal : public SignalModel
+{
+public:
+    explicit BatterySignal(double discharge_ms) : SignalModel(5, 3), discharge_ms_(discharge_ms) {}
+    std::string_view name() const override { return "BATTERY"; }
+    void generate(const double *time_ms, size_t count, double *millivolts, double *milliamps) const override
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            double charge = 1.0 - time_ms[i] / this->discharge_ms_;
+            charge = charge < 0.0 ? 0.0 : charge;
+            millivolts[i] = 3000.0 + 700.0 * charge + 500.0 * std::sqrt(charge);
+            milliamps[i] = charge > 0.0 ? 80.0 : 0.0;
+        }
+    }
+
+private:
+    double discharge_ms_;
+};
+
+// STEP[:period_ms,fault_ms]: nominal 3300 mV / 20 mA, with a fault (sag to 1900 mV, 100 mA draw)
+// during the last fault_ms of every period
+class StepSignal : public SignalModel
+{
+public:
+    StepSignal(double period_ms, double fault_ms) : SignalModel(20, 2), period_ms_(period_ms), fault_ms_(fault_ms) {}
+    std::string_view name() const override { return "STEP"; }
+    void generate(const double *time_ms, size_t count, double *millivolts, double *milliamps) const override
+    {
+        const double fault_start = 1.0 - this->fault_ms_ / this->period_ms_;
+        for (size_t i = 0; i < count; i++)
+        {
+            bool fault = phase(time_ms[i], this->period_ms_) >= fault_start;
+            millivolts[i] = fault ? 1900.0 : 3300.0;
+            milliamps[i] = fault ? 100.0 : 20.0;
+        }
+    }
+
+private:
+    double period_ms_;
+    double fault_ms_;
+};
+
+// CSV:path: replays recorded "time_ms,mv,ma" rows, holding each value until the next row and
+// looping once the recording runs out
+class CsvSignal : public SignalModel
+{
+public:
+    std::string_view name() const override { return "CSV"; }
+
+    // Loads the recording at path; returns nullptr (logging why) if it cannot be read or has no rows
+    static std::shared_ptr<const CsvSignal> load(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            LOG_ERROR("Error opening signal file %s: %s", path.c_str(), std::strerror(errno));
+            return nullptr;
+        }
+
+        std::shared_ptr<CsvSignal> signal(new CsvSignal());
+        std::string line;
+        while (std::getline(file, line))
+        {
+            double values[3];
+            const char *pos = line.data();
+            const char *end = line.data() + line.size();
+            int parsed = 0;
+            for (; parsed < 3; parsed++)
+            {
+                std::from_chars_result result = std::from_chars(pos, end, values[parsed]);
+                if (result.ec != std::errc())
+                {
+                    break;
+                }
+                pos = result.ptr < end && *result.ptr == ',' ? result.ptr + 1 : result.ptr;
+            }
+            if (parsed != 3)
+            {
+                continue; // header or malformed row
+            }
+            if (!signal->time_ms_.empty() && values[0] <= signal->time_ms_.back())
+            {
+                LOG_ERROR("Error in signal file %s: times must increase", path.c_str());
+                return nullptr;
+            }
+            signal->time_ms_.push_back(values[0]);
+            signal->millivolts_.push_back(values[1]);
+            signal->milliamps_.push_back(values[2]);
+        }
+        if (signal->time_ms_.empty())
+        {
+            LOG_ERROR("Error in signal file %s: no \"time_ms,mv,ma\" rows", path.c_str());
+            return nullptr;
+        }
+        size_t rows = signal->time_ms_.size();
+        double last_step = rows > 1 ? signal->time_ms_[rows - 1] - signal->time_ms_[rows - 2] : 1.0;
+        signal->period_ms_ = signal->time_ms_[rows - 1] + last_step;
+        return signal;
+    }
+
+    void generate(const double *time_ms, size_t count, double *millivolts, double *milliamps) const override
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            double t = phase(time_ms[i], this->period_ms_) * this->period_ms_;
+            size_t row = std::upper_bound(this->time_ms_.begin(), this->time_ms_.end(), t) - this->time_ms_.begin();
+            row = row == 0 ? 0 : row - 1;
+            millivolts[i] = this->millivolts_[row];
+            milliamps[i] = this->milliamps_[row];
+        }
+    }
+
+private:
+    CsvSignal() : SignalModel(0, 0) {}
+
+    std::vector<double> time_ms_;
+    std::vector<double> millivolts_;
+    std::vector<double> milliamps_;
+    double period_ms_ = 1.0;
+};
+
+// Builds the signal model described by spec ("NAME" or "NAME:arg,arg"); returns nullptr if it is invalid.
+// CSV replay reads a local file, so it is only accepted when allow_files is set (from the command line).
+std::shared_ptr<const SignalModel> make_signal_model(std::string_view spec, bool allow_files)
+{
+    std::string_view name = spec.substr(0, spec.find(':'));
+    std::string_view args = name.size() < spec.size() ? spec.substr(name.size() + 1) : std::string_view();
+
+    if (name == "CSV")
+    {
+        if (!allow_files || args.empty())
+        {
+            return nullptr;
+        }
+        return CsvSignal::load(std::string(args));
+    }
+
+    // every other model takes up to two positive numeric arguments
+    double params[2] = {0.0, 0.0};
+    size_t param_count = 0;
+    const char *pos = args.data();
+    const char *end = args.data() + args.size();
+    while (pos < end)
+    {
+        if (param_count == 2)
+        {
+            return nullptr;
+        }
+        std::from_chars_result result = std::from_chars(pos, end, params[param_count]);
+        if (result.ec != std::errc() || !(params[param_count] > 0.0) || (result.ptr < end && *result.ptr != ','))
+        {
+            return nullptr;
+        }
+        param_count++;
+        pos = result.ptr < end ? result.ptr + 1 : result.ptr;
+    }
+    auto param = [&](size_t i, double fallback)
+    { return i < param_count ? params[i] : fallback; };
+
+    if (name == "NOISE" && param_count == 0)
+    {
+        return std::make_shared<NoiseSignal>();
+    }
+    if (name == "SINE" && param_count <= 1)
+    {
+        return std::make_shared<SineSignal>(param(0, 2000.0));
+    }
+    if (name == "RAMP" && param_count <= 1)
+    {
+        return std::make_shared<RampSignal>(param(0, 10000.0));
+    }
+    if (name == "BATTERY" && param_count <= 1)
+    {
+        return std::make_shared<BatterySignal>(param(0, 600000.0));
+    }
+    if (name == "STEP")
+    {
+        double period = param(0, 1000.0);
+        double fault = param(1, period / 10);
+        if (fault >= period)
+        {
+            return nullptr;
+        }
+        return std::make_shared<StepSignal>(period, fault);
+    }
+    return nullptr;
+}
+
+// SampleQueue carries readings from a device's sampler to its server. Sample headers travel through an
+// SpscRing; the channel values of each slot sit beside it in one array per quantity, a slot's channels
+// contiguous, so a reading of every channel is written and read as two short blocks.
+class SampleQueue
+{
+public:
+    static constexpr size_t kCapacity = 1024;
+
+    explicit SampleQueue(size_t channels) : channels_(channels) {}
+
+    size_t channels() const { return this->channels_; }
+
+    // Allocates the channel arrays on first use, so an idle device holds none. Must be called before
+    // a sampler is handed the queue; later calls do nothing.
+    void allocate()
+    {
+        if (this->millivolts_.empty())
+        {
+            this->millivolts_.resize(kCapacity * this->channels_);
+            this->milliamps_.resize(kCapacity * this->channels_);
+        }
+    }
+
+    // Producer side: claim() a slot (nullptr if full), fill it and its channel arrays, then publish()
+    Sample *claim() { return this->ring_.claim(); }
+    void publish() { this->ring_.publish(); }
+
+    // Consumer side: front() (nullptr if empty) stays readable, channel arrays included, until release()
+    const Sample *front() const { return this->ring_.front(); }
+    void release() { this->ring_.release(); }
+
+    // Channel values of a claimed or front slot, channels() of each
+    int32_t *millivolts(const Sample *slot) { return &this->millivolts_[this->ring_.index_of(slot) * this->channels_]; }
+    int32_t *milliamps(const Sample *slot) { return &this->milliamps_[this->ring_.index_of(slot) * this->channels_]; }
+
+    // Readings the producer found no free slot for; any thread may read it
+    void count_dropped() { this->dropped_.fetch_add(1, std::memory_order_relaxed); }
+    uint64_t dropped() const { return this->dropped_.load(std::memory_order_relaxed); }
+
+private:
+    // Member variables
+    SpscRing<Sample, kCapacity> ring_;
+    std::atomic<uint64_t> dropped_{0};
+    size_t channels_;
+    std::vector<int32_t> millivolts_;
+    std::vector<int32_t> milliamps_;
+};
+
+// Device class represents a simulated device with a model, serial number, and idle state.
+class Device
+{
+public:
+    // Largest number of channels a device may have
+    static constexpr size_t kMaxChannels = 64;
+
+    // Constructor: initializes the device with the given model, serial number and channel count
+    // The measurement generators are seeded from the serial number, so a run is reproducible per device
+    Device(std::string model, int serial_number, size_t channels = 1)
+        : model_(model), serial_number_(serial_number), channels_(channels),
+          millivolts_rng_(static_cast<uint64_t>(serial_number) << 1),
+          milliamps_rng_(static_cast<uint64_t>(serial_number) << 1 | 1),
+          signal_(std::make_shared<NoiseSignal>()), samples_(channels) {}
+
+    // Member variables
+    std::string model_;
+    int serial_number_;
+    size_t channels_; // each channel reads one MV and one MA value per sample
+    bool is_idle_ = true;
+
+    // Per-device noise generators, one stream per quantity
+    MeasurementRng millivolts_rng_;
+    MeasurementRng milliamps_rng_;
+
+    // Waveform used by tests that do not pick their own
+    std::shared_ptr<const SignalModel> signal_;
+
+    // Readings taken by the sampler thread and drained by the server that transmits them
+    SampleQueue samples_;
+
+    // Accessor functions
+    const std::string &model() const { return model_; }
+    int serial_number() const { return serial_number_; }
+    size_t channels() const { return channels_; }
+    bool is_idle() const { return is_idle_; }
+
+    SampleQueue &samples() { return samples_; }
+    const std::shared_ptr<const SignalModel> &signal() const { return signal_; }
+
+    // Mutator functions
+    void set_is_idle(bool state) { this->is_idle_ = state; }
+    void set_signal(std::shared_ptr<const SignalModel> signal) { this->signal_ = std::move(signal); }
+
+    // Maximum number of readings simulated per read_block() call
+    static constexpr size_t kMaxBlock = 64;
+
+    // Simulates count (at most kMaxBlock) readings of signal on every channel, taken every step_ms from
+    // first_ms on, in one pass: the model's levels plus this device's noise, clamped to what a frame can
+    // carry. The outputs hold channels() runs of count readings each, channel 0 first.
+    void read_block(const SignalModel &signal, int64_t first_ms, int64_t step_ms, size_t count,
+                    int32_t *millivolts, int32_t *milliamps)
+    {
+        double time_ms[kMaxBlock] = {}; // zeroed only to quiet -O2's -Wmaybe-uninitialized
+        double millivolt_levels[kMaxBlock];
+        double milliamp_levels[kMaxBlock];
+        for (size_t i = 0; i < count; i++)
+        {
+            time_ms[i] = static_cast<double>(first_ms + static_cast<int64_t>(i) * step_ms);
+        }
+        signal.generate(time_ms, count, millivolt_levels, milliamp_levels);
+
+        int32_t mv_noise = signal.millivolts_noise();
+        int32_t ma_noise = signal.milliamps_noise();
+        this->millivolts_rng_.fill_uniform(millivolts, count * this->channels_, -mv_noise, 2 * static_cast<uint32_t>(mv_noise));
+        this->milliamps_rng_.fill_uniform(milliamps, count * this->channels_, -ma_noise, 2 * static_cast<uint32_t>(ma_noise));
+        for (size_t channel = 0; channel < this->channels_; channel++)
+        {
+            int32_t *channel_mv = millivolts + channel * count;
+            int32_t *channel_ma = milliamps + channel * count;
+            for (size_t i = 0; i < count; i++)
+            {
+                channel_mv[i] = clamp_reading(static_cast<int32_t>(millivolt_levels[i] + 0.5) + channel_mv[i]);
+                channel_ma[i] = clamp_reading(static_cast<int32_t>(milliamp_levels[i] + 0.5) + channel_ma[i]);
+            }
+        }
+    }
+
+private:
+    static int32_t clamp_reading(int32_t value)
+    {
+        return value < 0 ? 0 : (value > INT16_MAX ? INT16_MAX : value);
+    }
+};
+
+// TimerWheel class is a hierarchical timing wheel (4 levels of 256 slots, 1 ms ticks) that schedules
+// callbacks on absolute deadlines. Timers due on the same tick expire together in one advance() batch.
+class TimerWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr int kLevels = 4;
+    static constexpr int kSlotBits = 8;
+    static constexpr int kSlots = 1 << kSlotBits;
+    static constexpr uint64_t kSlotMask = kSlots - 1;
+    static constexpr int64_t kTickNs = 1000000; // 1 ms
+
+    // Timer is an intrusive wheel entry owned by the caller; scheduling and cancelling never allocate
+    class Timer
+    {
+    public:
+        explicit Timer(std::function<void()> callback) : callback_(std::move(callback)) {}
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+        bool scheduled() const { return this->pprev_ != nullptr; }
+
+    private:
+        friend class TimerWheel;
+        std::function<void()> callback_;
+        uint64_t expires_ = 0;    // absolute tick
+        Timer *next_ = nullptr;   // next entry in the same slot
+        Timer **pprev_ = nullptr; // link pointing at this entry, nullptr when not scheduled
+    };
+
+    // Constructor: tick 0 of the wheel is epoch, by default the moment it is created
+    explicit TimerWheel(Clock::time_point epoch = Clock::now()) : epoch_(epoch) {}
+
+    // Schedules timer to expire on the first tick at or after deadline (rescheduling it if already pending)
+    void schedule(Timer &timer, Clock::time_point deadline)
+    {
+        cancel(timer);
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - this->epoch_).count();
+        uint64_t tick = ns <= 0 ? 0 : static_cast<uint64_t>((ns + kTickNs - 1) / kTickNs);
+        timer.expires_ = tick < this->next_tick_ ? this->next_tick_ : tick;
+        place(timer, this->next_tick_);
+        this->count_++;
+    }
+
+    // Removes timer from the wheel; a no-op if it is not scheduled
+    void cancel(Timer &timer)
+    {
+        if (!timer.scheduled())
+        {
+            return;
+        }
+        unlink(timer);
+        this->count_--;
+    }
+
+    // Expires every timer due at or before now, running callbacks in deadline order
+    void advance(Clock::time_point now)
+    {
+        uint64_t now_tick = to_tick(now);
+        while (this->count_ > 0 && this->next_tick_ <= now_tick)
+        {
+            uint64_t tick = this->next_tick_;
+            if ((tick & kSlotMask) == 0)
+            {
+                // pull the next span of timers down from the coarser levels
+                for (int level = 1; level < kLevels; level++)
+                {
+                    cascade(level, tick);
+                    if (((tick >> (level * kSlotBits)) & kSlotMask) != 0)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            // move the due slot onto the expired list so callbacks may freely schedule or cancel timers
+            Timer *&slot = this->slots_[0][tick & kSlotMask];
+            this->expired_ = slot;
+            if (this->expired_ != nullptr)
+            {
+                this->expired_->pprev_ = &this->expired_;
+            }
+            slot = nullptr;
+            this->next_tick_ = tick + 1;
+
+            while (this->expired_ != nullptr)
+            {
+                Timer &timer = *this->expired_;
+                unlink(timer);
+                this->count_--;
+                timer.callback_();
+            }
+        }
+        if (this->count_ == 0 && this->next_tick_ <= now_tick)
+        {
+            this->next_tick_ = now_tick + 1; // nothing pending, skip the idle ticks
+        }
+    }
+
+    // Returns the next time advance() has work to do (an expiry or a cascade), or false when the wheel is empty
+    bool next_wakeup(Clock::time_point &wakeup) const
+    {
+        if (this->count_ == 0)
+        {
+            return false;
+        }
+        uint64_t tick = this->next_tick_;
+        if ((tick & kSlotMask) == 0 && cascade_pending(tick))
+        {
+            // the cascade at this boundary has not run yet, so level 0 does not hold this span's timers
+            wakeup = this->epoch_ + std::chrono::nanoseconds(static_cast<int64_t>(tick) * kTickNs);
+            return true;
+        }
+        do
+        {
+            if (this->slots_[0][tick & kSlotMask] != nullptr)
+            {
+                break;
+            }
+            tick++;
+        } while ((tick & kSlotMask) != 0);
+        wakeup = this->epoch_ + std::chrono::nanoseconds(static_cast<int64_t>(tick) * kTickNs);
+        return true;
+    }
+
+private:
+    // Member variables
+    Clock::time_point epoch_;
+    uint64_t next_tick_ = 0; // first tick not yet processed
+    size_t count_ = 0;
+    Timer *slots_[kLevels][kSlots] = {};
+    Timer *expired_ = nullptr;
+
+    uint64_t to_tick(Clock::time_point t) const
+    {
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t - this->epoch_).count();
+        return ns <= 0 ? 0 : static_cast<uint64_t>(ns / kTickNs);
+    }
+
+    // Links timer into the slot matching its distance from base
+    void place(Timer &timer, uint64_t base)
+    {
+        uint64_t delta = timer.expires_ - base;
+        int level = 0;
+        while (level < kLevels - 1 && delta >= (uint64_t{1} << ((level + 1) * kSlotBits)))
+        {
+            level++;
+        }
+        uint64_t expires = timer.expires_;
+        if (delta >= (uint64_t{1} << (kLevels * kSlotBits)))
+        {
+            expires = base + (uint64_t{1} << (kLevels * kSlotBits)) - 1; // beyond the wheel, revisit on cascade
+        }
+        Timer *&slot = this->slots_[level][(expires >> (level * kSlotBits)) & kSlotMask];
+        timer.next_ = slot;
+        if (slot != nullptr)
+        {
+            slot->pprev_ = &timer.next_;
+        }
+        slot = &timer;
+        timer.pprev_ = &slot;
+    }
+
+    void unlink(Timer &timer)
+    {
+        *timer.pprev_ = timer.next_;
+        if (timer.next_ != nullptr)
+        {
+            timer.next_->pprev_ = timer.pprev_;
+        }
+        timer.next_ = nullptr;
+        timer.pprev_ = nullptr;
+    }
+
+    // Returns whether advance() would pull any timer down from a coarser level at boundary tick
+    bool cascade_pending(uint64_t tick) const
+    {
+        for (int level = 1; level < kLevels; level++)
+        {
+            if (this->slots_[level][(tick >> (level * kSlotBits)) & kSlotMask] != nullptr)
+            {
+                return true;
+            }
+            if (((tick >> (level * kSlotBits)) & kSlotMask) != 0)
+            {
+                break;
+            }
+        }
+        return false;
+    }
+
+    // Redistributes one slot of a coarser level into the finer levels
+    void cascade(int level, uint64_t tick)
+    {
+        Timer *&slot = this->slots_[level][(tick >> (level * kSlotBits)) & kSlotMask];
+        Timer *timer = slot;
+        slot = nullptr;
+        while (timer != nullptr)
+        {
+            Timer *next = timer->next_;
+            timer->next_ = nullptr;
+            timer->pprev_ = nullptr;
+            place(*timer, tick);
+            timer = next;
+        }
+    }
+};
+
+// Sampler class runs a dedicated thread that takes device readings at their exact RATE deadlines and
+// pushes them into each device's sample ring, independently of how fast the readings get transmitted.
+// Other threads control it only through start()/stop(), which post commands to its mailbox.
+class Sampler
+{
+public:
+    using Clock = TimerWheel::Clock;
+
+    // Job is the sampling state of one device. It is owned by the caller but, once started,
+    // only ever touched by the sampler thread.
+    class Job
+    {
+    public:
+        explicit Job(Device &device)
+            : device_(device), millivolts_(Device::kMaxBlock * device.channels()),
+              milliamps_(Device::kMaxBlock * device.channels()), timer_([this]
+                                                                    { this->owner_->sample(*this); }) {}
+        Job(const Job &) = delete;
+        Job &operator=(const Job &) = delete;
+
+    private:
+        friend class Sampler;
+        Device &device_;
+        Sampler *owner_ = nullptr;
+        std::shared_ptr<const SignalModel> signal_;
+        std::vector<int32_t> millivolts_; // block of readings, laid out as Device::read_block() writes them
+        std::vector<int32_t> milliamps_;
+        size_t block_next_ = 0; // next unused reading in the block, block_count_ when exhausted
+        size_t block_count_ = 0;
+        std::chrono::milliseconds rate_{1};
+        Clock::time_point start_time_;
+        Clock::time_point end_time_;
+        int64_t tick_ = 0;
+        uint32_t generation_ = 0;
+        TimerWheel::Timer timer_;
+    };
+
+    // Constructor: starts the sampler thread
+    Sampler() : thread_([this]
+                        { this->run(); }) {}
+
+    ~Sampler() { shutdown(); }
+
+    Sampler(const Sampler &) = delete;
+    Sampler &operator=(const Sampler &) = delete;
+
+    // The sampler thread, for pinning it to a core
+    std::thread::native_handle_type native_handle() { return this->thread_.native_handle(); }
+
+    // Starts sampling job's device every rate from start_time until start_time + duration, tagging
+    // the samples with generation; a marker sample with last set follows the final reading
+    void start(Job &job, std::shared_ptr<const SignalModel> signal, std::chrono::milliseconds rate,
+               std::chrono::seconds duration, Clock::time_point start_time, uint32_t generation)
+    {
+        Command command;
+        command.kind = Command::Start;
+        command.job = &job;
+        command.signal = std::move(signal);
+        command.rate = rate;
+        command.start_time = start_time;
+        command.end_time = start_time + duration;
+        command.generation = generation;
+        post(command);
+    }
+
+    // Stops sampling job's device; readings already in the ring stay there. The sampler thread wakes
+    // at once and, if given, calls on_stopped once it has taken the job's last reading: from then on
+    // every reading of the job is in the ring and no more will follow.
+    void stop(Job &job, std::function<void()> on_stopped = nullptr)
+    {
+        Command command;
+        command.kind = Command::Stop;
+        command.job = &job;
+        command.on_stopped = std::move(on_stopped);
+        post(command);
+    }
+
+    // Stops the sampler thread and waits for it to exit
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->running_ = false;
+        }
+        this->wakeup_.notify_one();
+        if (this->thread_.joinable())
+        {
+            this->thread_.join();
+        }
+    }
+
+private:
+    struct Command
+    {
+        enum Kind
+        {
+            Start,
+            Stop
+        } kind;
+        Job *job;
+        std::function<void()> on_stopped; // Stop only
+        std::shared_ptr<const SignalModel> signal;
+        std::chrono::milliseconds rate;
+        Clock::time_point start_time;
+        Clock::time_point end_time;
+        uint32_t generation;
+    };
+
+    // Member variables (mutex_ guards running_ and mailbox_; the wheel belongs to the sampler thread)
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool running_ = true;
+    std::vector<Command> mailbox_;
+    std::vector<Command> commands_; // sampler thread's copy of the mailbox
+    TimerWheel wheel_;
+    std::thread thread_;
+
+    void post(const Command &command)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->mailbox_.push_back(command);
+        }
+        this->wakeup_.notify_one();
+    }
+
+    // Sampler thread: applies posted commands, fires due sampling ticks, then sleeps until the next one
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        while (this->running_)
+        {
+            this->commands_.swap(this->mailbox_);
+            lock.unlock();
+
+            for (const Command &command : this->commands_)
+            {
+                apply(command);
+            }
+            this->commands_.clear();
+            this->wheel_.advance(Clock::now());
+
+            Clock::time_point wakeup;
+            bool pending = this->wheel_.next_wakeup(wakeup);
+            lock.lock();
+            auto ready = [this]
+            { return !this->running_ || !this->mailbox_.empty(); };
+            if (pending)
+            {
+                this->wakeup_.wait_until(lock, wakeup, ready);
+            }
+            else
+            {
+                this->wakeup_.wait(lock, ready);
+            }
+        }
+    }
+
+    void apply(const Command &command)
+    {
+        Job &job = *command.job;
+        this->wheel_.cancel(job.timer_);
+        if (command.kind == Command::Stop)
+        {
+            if (command.on_stopped)
+            {
+                command.on_stopped();
+            }
+            return;
+        }
+        job.owner_ = this;
+        job.signal_ = command.signal;
+        job.block_next_ = 0;
+        job.block_count_ = 0;
+        job.rate_ = command.rate;
+        job.start_time_ = command.start_time;
+        job.end_time_ = command.end_time;
+        job.tick_ = 0;
+        job.generation_ = command.generation;
+        this->wheel_.schedule(job.timer_, job.start_time_);
+    }
+
+    // Takes one reading for job on its scheduled deadline start + tick * rate.
+    // TIME is that scheduled offset, so it never accumulates drift over long runs.
+    void sample(Job &job)
+    {
+        auto offset = job.tick_ * job.rate_;
+        auto deadline = job.start_time_ + offset;
+        SampleQueue &queue = job.device_.samples();
+        Sample *sample = queue.claim();
+        if (deadline > job.end_time_)
+        {
+            if (sample == nullptr)
+            {
+                // the marker must not be lost or the test never ends; retry once the consumer catches up
+                this->wheel_.schedule(job.timer_, Clock::now() + std::chrono::milliseconds{1});
+                return;
+            }
+            sample->time_ms = offset.count();
+            sample->taken_ns = 0;
+            sample->generation = job.generation_;
+            sample->last = true;
+            queue.publish();
+            return;
+        }
+
+        if (job.block_next_ == job.block_count_)
+        {
+            // simulate the next block of readings ahead of time, up to the end of the test
+            int64_t remaining = (job.end_time_ - deadline) / job.rate_ + 1;
+            job.block_count_ = remaining < static_cast<int64_t>(Device::kMaxBlock) ? static_cast<size_t>(remaining) : Device::kMaxBlock;
+            job.block_next_ = 0;
+            job.device_.read_block(*job.signal_, offset.count(), job.rate_.count(), job.block_count_,
+                                   job.millivolts_.data(), job.milliamps_.data());
+        }
+        if (sample != nullptr) // a full ring drops the reading rather than stall sampling
+        {
+            sample->time_ms = offset.count();
+            sample->taken_ns = realtime_ns();
+            sample->generation = job.generation_;
+            sample->last = false;
+            int32_t *millivolts = queue.millivolts(sample);
+            int32_t *milliamps = queue.milliamps(sample);
+            for (size_t channel = 0; channel < queue.channels(); channel++)
+            {
+                millivolts[channel] = job.millivolts_[channel * job.block_count_ + job.block_next_];
+                milliamps[channel] = job.milliamps_[channel * job.block_count_ + job.block_next_];
+            }
+            queue.publish();
+        }
+        else
+        {
+            queue.count_dropped();
+        }
+        job.block_next_++;
+
+        job.tick_++;
+        this->wheel_.schedule(job.timer_, deadline + job.rate_);
+    }
+};
+
+// RecvBatch holds the buffers a single recvmmsg call drains datagrams into
+struct RecvBatch
+{
+    static constexpr int kCapacity = 32;
+    static constexpr size_t kBufferSize = 1024;
+
+    char buffers[kCapacity][kBufferSize];
+    sockaddr_in addrs[kCapacity];
+    iovec iovs[kCapacity];
+    mmsghdr msgs[kCapacity];
+
+    // Receives up to kCapacity datagrams from fd without blocking; returns how many, or -1 with errno set
+    int receive(int fd)
+    {
+        for (int i = 0; i < kCapacity; i++)
+        {
+            this->iovs[i].iov_base = this->buffers[i];
+            this->iovs[i].iov_len = kBufferSize;
+            this->msgs[i].msg_hdr = msghdr{};
+            this->msgs[i].msg_hdr.msg_name = &this->addrs[i];
+            this->msgs[i].msg_hdr.msg_namelen = sizeof(this->addrs[i]);
+            this->msgs[i].msg_hdr.msg_iov = &this->iovs[i];
+            this->msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        return recvmmsg(fd, this->msgs, kCapacity, MSG_DONTWAIT, nullptr);
+    }
+
+    const char *data(int i) const { return this->buffers[i]; }
+    size_t length(int i) const { return this->msgs[i].msg_len; }
+    const sockaddr_in &addr(int i) const { return this->addrs[i]; }
+};
+
+// EventLoop class is a single-threaded epoll reactor that dispatches readable file descriptors
+// (UDP sockets) to their registered handlers, and runs a TimerWheel off a single timerfd.
+// Outgoing datagrams are queued during a dispatch round and flushed with one sendmmsg per socket.
+class EventLoop
+{
+public:
+    using Handler = std::function<void()>;
+
+    // Called with the tag a datagram was queued with and the time, in realtime_ns(), the kernel handed it to the network device
+    using TransmitHandler = std::function<void(uint64_t tag, int64_t sent_ns)>;
+
+    // Tag of a datagram nobody wants a transmit timestamp for
+    static constexpr uint64_t kUntagged = UINT64_MAX;
+
+    // Constructor: creates the epoll instance, the timerfd driving the timer wheel and the eventfd
+    // that wakes the loop for posted tasks
+    EventLoop()
+    {
+        this->epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        this->timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        this->wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (this->epoll_fd_ < 0 || this->timer_fd_ < 0 || this->wake_fd_ < 0)
+        {
+            LOG_ERROR("Error creating event loop: %s", std::strerror(errno));
+            return;
+        }
+        add(this->timer_fd_, [this]
+            { this->on_timer(); });
+        add(this->wake_fd_, [this]
+            { this->on_wake(); });
+    }
+
+    ~EventLoop()
+    {
+        if (this->wake_fd_ >= 0)
+        {
+            close(this->wake_fd_);
+        }
+        if (this->timer_fd_ >= 0)
+        {
+            close(this->timer_fd_);
+        }
+        if (this->epoll_fd_ >= 0)
+        {
+            close(this->epoll_fd_);
+        }
+    }
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // Registers a handler that is called whenever fd becomes readable
+    bool add(int fd, Handler on_readable)
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            LOG_ERROR("Error registering file descriptor: %s", std::strerror(errno));
+            return false;
+        }
+        this->handlers_[fd] = std::make_shared<Handler>(std::move(on_readable));
+        return true;
+    }
+
+    // Unregisters fd; its handler is never called again, even for events already fetched
+    void remove(int fd)
+    {
+        epoll_ctl(this->epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        this->handlers_.erase(fd);
+        this->tx_stamps_.erase(fd);
+    }
+
+    // Has the kernel timestamp every datagram sent from fd, a registered UDP socket, from now on
+    // (SO_TIMESTAMPING software TX stamps), and reports those of tagged datagrams to on_sent
+    bool enable_tx_timestamps(int fd, TransmitHandler on_sent)
+    {
+        uint32_t flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+        {
+            LOG_ERROR("Error enabling transmit timestamps: %s", std::strerror(errno));
+            return false;
+        }
+        std::unique_ptr<TransmitStamps> &stamps = this->tx_stamps_[fd];
+        if (stamps == nullptr)
+        {
+            // the kernel numbers timestamped datagrams from 0 the first time OPT_ID is set
+            stamps.reset(new TransmitStamps());
+            std::fill(std::begin(stamps->tags), std::end(stamps->tags), kUntagged);
+        }
+        stamps->on_sent = std::move(on_sent);
+        stamps->enabled = true;
+        return true;
+    }
+
+    // Stops timestamping fd's datagrams; the stamps of those already sent are still reported
+    void disable_tx_timestamps(int fd)
+    {
+        auto it = this->tx_stamps_.find(fd);
+        if (it == this->tx_stamps_.end())
+        {
+            return;
+        }
+        // OPT_ID stays set, so the kernel's numbering carries on from where it was if stamps come back on
+        uint32_t flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+        it->second->enabled = false;
+    }
+
+    // Schedules timer to run its callback on this loop at the given absolute deadline
+    void schedule(TimerWheel::Timer &timer, TimerWheel::Clock::time_point deadline)
+    {
+        this->wheel_.schedule(timer, deadline);
+        rearm();
+    }
+
+    // Cancels a scheduled timer
+    void cancel(TimerWheel::Timer &timer) { this->wheel_.cancel(timer); }
+
+    // Queues task to run on this loop's thread; the only EventLoop call that is safe from other threads
+    void post(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->posted_mutex_);
+            this->posted_.push_back(std::move(task));
+        }
+        uint64_t one = 1;
+        if (write(this->wake_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        {
+            LOG_ERROR("Error waking event loop: %s", std::strerror(errno));
+        }
+    }
+
+    // Queues a datagram to be sent from fd once the current dispatch round is over. With transmit
+    // timestamps enabled on fd, the one the kernel reports for it is passed on with tag.
+    void send(int fd, const sockaddr_in &addr, const char *data, size_t len, uint64_t tag = kUntagged)
+    {
+        PendingSend pending;
+        pending.fd = fd;
+        pending.addr = addr;
+        pending.offset = this->tx_bytes_.size();
+        pending.len = len;
+        pending.tag = tag;
+        this->tx_bytes_.append(data, len);
+        this->tx_pending_.push_back(pending);
+    }
+
+    // Queues one datagram to each of count addresses; the bytes are stored once and shared by every copy
+    void send_to_all(int fd, const sockaddr_in *addrs, size_t count, const char *data, size_t len, uint64_t tag = kUntagged)
+    {
+        PendingSend pending;
+        pending.fd = fd;
+        pending.offset = this->tx_bytes_.size();
+        pending.len = len;
+        pending.tag = tag;
+        this->tx_bytes_.append(data, len);
+        for (size_t i = 0; i < count; i++)
+        {
+            pending.addr = addrs[i];
+            this->tx_pending_.push_back(pending);
+        }
+    }
+
+    // Sends every queued datagram, batching those that share a socket into sendmmsg calls
+    void flush_sends()
+    {
+        if (this->tx_pending_.empty())
+        {
+            return;
+        }
+
+        // group by socket while keeping each socket's datagrams in the order they were queued
+        this->tx_order_.clear();
+        for (size_t i = 0; i < this->tx_pending_.size(); i++)
+        {
+            this->tx_order_.push_back(i);
+        }
+        std::sort(this->tx_order_.begin(), this->tx_order_.end(), [this](size_t a, size_t b)
+                  { return this->tx_pending_[a].fd != this->tx_pending_[b].fd
+                               ? this->tx_pending_[a].fd < this->tx_pending_[b].fd
+                               : a < b; });
+
+        size_t run_start = 0;
+        while (run_start < this->tx_order_.size())
+        {
+            int fd = this->tx_pending_[this->tx_order_[run_start]].fd;
+            size_t run_end = run_start;
+            this->tx_iovs_.clear();
+            this->tx_msgs_.clear();
+            this->tx_tags_.clear();
+            while (run_end < this->tx_order_.size() && this->tx_pending_[this->tx_order_[run_end]].fd == fd)
+            {
+                PendingSend &pending = this->tx_pending_[this->tx_order_[run_end]];
+                iovec iov;
+                iov.iov_base = &this->tx_bytes_[pending.offset];
+                iov.iov_len = pending.len;
+                this->tx_iovs_.push_back(iov);
+                this->tx_tags_.push_back(pending.tag);
+                run_end++;
+            }
+            for (size_t i = run_start; i < run_end; i++)
+            {
+                mmsghdr msg{};
+                msg.msg_hdr.msg_name = &this->tx_pending_[this->tx_order_[i]].addr;
+                msg.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+                msg.msg_hdr.msg_iov = &this->tx_iovs_[i - run_start];
+                msg.msg_hdr.msg_iovlen = 1;
+                this->tx_msgs_.push_back(msg);
+            }
+            send_batch(fd);
+            run_start = run_end;
+        }
+
+        this->tx_pending_.clear();
+        this->tx_bytes_.clear();
+    }
+
+    // Dispatches events until stop() is called
+    void run()
+    {
+        this->running_ = true;
+        epoll_event events[64];
+        while (this->running_)
+        {
+            int ready = epoll_wait(this->epoll_fd_, events, 64, -1);
+            if (ready < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                LOG_ERROR("Error waiting for events: %s", std::strerror(errno));
+                return;
+            }
+
+            for (int i = 0; i < ready; i++)
+            {
+                auto it = this->handlers_.find(events[i].data.fd);
+                if (it == this->handlers_.end())
+                {
+                    continue; // removed by an earlier handler in this batch
+                }
+                std::shared_ptr<Handler> handler = it->second; // keep alive if the handler removes itself
+                if (events[i].events & EPOLLERR)
+                {
+                    read_tx_stamps(events[i].data.fd);
+                }
+                (*handler)();
+            }
+            flush_sends();
+        }
+    }
+
+    // Receive buffers shared by every socket served from this loop
+    RecvBatch &recv_batch() { return this->recv_batch_; }
+
+    // Makes run() return after the current batch of events
+    void stop() { this->running_ = false; }
+
+private:
+    // Member variables
+    int epoll_fd_;
+    int timer_fd_;
+    int wake_fd_;
+    bool running_ = false;
+    std::unordered_map<int, std::shared_ptr<Handler>> handlers_;
+    TimerWheel wheel_;
+    TimerWheel::Clock::time_point armed_for_ = TimerWheel::Clock::time_point::max();
+    RecvBatch recv_batch_;
+    std::mutex posted_mutex_; // guards posted_, the only state other threads touch
+    std::vector<std::function<void()>> posted_;
+    std::vector<std::function<void()>> running_tasks_; // loop thread's copy of posted_
+
+    static constexpr size_t kMaxSendBatch = 1024; // the kernel's UIO_MAXIOV limit for one sendmmsg
+
+    // A datagram waiting for flush_sends(); its bytes live in tx_bytes_
+    struct PendingSend
+    {
+        int fd;
+        sockaddr_in addr;
+        size_t offset;
+        size_t len;
+        uint64_t tag;
+    };
+    std::vector<PendingSend> tx_pending_;
+    std::string tx_bytes_;
+    std::vector<size_t> tx_order_;
+    std::vector<iovec> tx_iovs_;
+    std::vector<mmsghdr> tx_msgs_;
+    std::vector<uint64_t> tx_tags_; // tag of each of tx_msgs_
+    bool send_blocked_ = false;     // the latest failed send was dropped for a full send buffer
+
+    // Transmit timestamping state of one socket. The kernel numbers the datagrams it timestamps
+    // (SOF_TIMESTAMPING_OPT_ID), and next_id follows that numbering by counting every datagram
+    // sendmmsg accepts while stamps are enabled, so a stamp finds its tag by the number it carries.
+    static constexpr size_t kTransmitTags = 256;
+    struct TransmitStamps
+    {
+        TransmitHandler on_sent;
+        bool enabled = false;
+        uint32_t next_id = 0;
+        uint32_t ids[kTransmitTags] = {}; // number and tag of the latest timestamped datagrams, by number % kTransmitTags
+        uint64_t tags[kTransmitTags];
+    };
+    std::unordered_map<int, std::unique_ptr<TransmitStamps>> tx_stamps_;
+
+    // Whether sendmmsg failing with error concerns only the first datagram it was given, so the
+    // datagrams after it may still be sent
+    static bool per_message_error(int error)
+    {
+        return error == EMSGSIZE || error == EACCES || error == EPERM || error == ENETUNREACH ||
+               error == EHOSTUNREACH || error == EINVAL || error == EAFNOSUPPORT || error == EDESTADDRREQ;
+    }
+
+    // Hands tx_msgs_ to the kernel for fd, reporting failed and partial sends. A datagram the kernel
+    // rejects is dropped on its own; when the socket's send buffer is full (or the kernel is out of
+    // buffers), the rest of the batch is dropped, counted, and left to RESEND and ACK pacing.
+    void send_batch(int fd)
+    {
+        size_t done = 0;
+        while (done < this->tx_msgs_.size())
+        {
+            size_t count = this->tx_msgs_.size() - done;
+            if (count > kMaxSendBatch)
+            {
+                count = kMaxSendBatch;
+            }
+            SendMetrics &metrics = SendMetrics::instance();
+            auto started = std::chrono::steady_clock::now();
+            int sent = sendmmsg(fd, &this->tx_msgs_[done], count, 0);
+            if (sent > 0)
+            {
+                number_tx_stamps(fd, done, static_cast<size_t>(sent));
+            }
+            metrics.call_time.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (per_message_error(errno))
+                {
+                    LOG_ERROR("Error sending message: %s", std::strerror(errno));
+                    metrics.failed.fetch_add(1, std::memory_order_relaxed);
+                    done++; // drop the datagram that failed and carry on with the rest
+                    continue;
+                }
+                uint64_t rest = this->tx_msgs_.size() - done;
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS || errno == ENOMEM)
+                {
+                    if (!this->send_blocked_)
+                    {
+                        LOG_WARN("Send buffer full, dropping datagrams: %s", std::strerror(errno)); // once per episode
+                        this->send_blocked_ = true;
+                    }
+                    metrics.dropped.fetch_add(rest, std::memory_order_relaxed);
+                }
+                else
+                {
+                    LOG_ERROR("Error sending messages: %s", std::strerror(errno));
+                    metrics.failed.fetch_add(rest, std::memory_order_relaxed);
+                }
+                return; // retrying now would only fail again
+            }
+            for (size_t i = done; i < done + static_cast<size_t>(sent); i++)
+            {
+                if (this->tx_msgs_[i].msg_len != this->tx_msgs_[i].msg_hdr.msg_iov->iov_len)
+                {
+                    LOG_WARN("Warning: Partial message sent.");
+                    metrics.partial.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            metrics.datagrams.fetch_add(static_cast<uint64_t>(sent), std::memory_order_relaxed);
+            done += sent;
+        }
+        this->send_blocked_ = false;
+    }
+
+    // Notes the numbers the kernel gave tx_msgs_[first, first + count), just sent from fd, if fd is timestamped
+    void number_tx_stamps(int fd, size_t first, size_t count)
+    {
+        auto it = this->tx_stamps_.find(fd);
+        if (it == this->tx_stamps_.end() || !it->second->enabled)
+        {
+            return;
+        }
+        TransmitStamps &stamps = *it->second;
+        for (size_t i = first; i < first + count; i++)
+        {
+            size_t slot = stamps.next_id % kTransmitTags;
+            stamps.ids[slot] = stamps.next_id++;
+            stamps.tags[slot] = this->tx_tags_[i];
+        }
+    }
+
+    // Reads the transmit timestamps waiting on fd's error queue, passing those of tagged datagrams on
+    void read_tx_stamps(int fd)
+    {
+        auto it = this->tx_stamps_.find(fd);
+        if (it == this->tx_stamps_.end())
+        {
+            return;
+        }
+        TransmitStamps &stamps = *it->second;
+        while (true)
+        {
+            alignas(cmsghdr) char control[256];
+            msghdr msg{};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            {
+                return; // drained
+            }
+            int64_t sent_ns = -1;
+            sock_extended_err error{};
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+                {
+                    scm_timestamping stamp;
+                    std::memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+                    sent_ns = static_cast<int64_t>(stamp.ts[0].tv_sec) * 1000000000 + stamp.ts[0].tv_nsec;
+                }
+                else if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR)
+                {
+                    std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+                }
+            }
+            if (sent_ns < 0 || error.ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+            {
+                continue;
+            }
+            size_t slot = error.ee_data % kTransmitTags;
+            if (stamps.ids[slot] == error.ee_data && stamps.tags[slot] != kUntagged)
+            {
+                stamps.on_sent(stamps.tags[slot], sent_ns);
+            }
+        }
+    }
+
+    // Runs every timer that has come due, then re-arms the timerfd for the next one
+    void on_timer()
+    {
+        uint64_t expirations;
+        if (read(this->timer_fd_, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        {
+            LOG_ERROR("Error reading timer: %s", std::strerror(errno));
+        }
+        this->armed_for_ = TimerWheel::Clock::time_point::max();
+        this->wheel_.advance(TimerWheel::Clock::now());
+        rearm();
+    }
+
+    // Runs every task posted since the last wakeup, in the order they were posted
+    void on_wake()
+    {
+        uint64_t count;
+        if (read(this->wake_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        {
+            LOG_ERROR("Error reading wakeup: %s", std::strerror(errno));
+        }
+        {
+            std::lock_guard<std::mutex> lock(this->posted_mutex_);
+            this->running_tasks_.swap(this->posted_);
+        }
+        for (std::function<void()> &task : this->running_tasks_)
+        {
+            task();
+        }
+        this->running_tasks_.clear();
+    }
+
+    // Points the timerfd at the wheel's next wakeup if that is earlier than what it is armed for
+    void rearm()
+    {
+        TimerWheel::Clock::time_point wakeup;
+        if (!this->wheel_.next_wakeup(wakeup) || wakeup >= this->armed_for_)
+        {
+            return;
+        }
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(wakeup.time_since_epoch()).count();
+        itimerspec spec{};
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        {
+            spec.it_value.tv_nsec = 1; // an all-zero value would disarm the timer
+        }
+        if (timerfd_settime(this->timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+        {
+            LOG_ERROR("Error arming timer: %s", std::strerror(errno));
+            return;
+        }
+        this->armed_for_ = wakeup;
+    }
+};
+
+// WorkerPool is the fixed set of workers a --workers process serves from, created once at startup.
+// Worker i is an event loop plus a Sampler: a device whose tests run on loop i is sampled by sampler i,
+// so starting and stopping tests never creates a thread. Loop 0 runs on the thread that calls run(),
+// every other loop on a thread of its own. With more than one worker, each worker's two threads are
+// pinned to its own core: the kernel's SO_REUSEPORT hashing spreads clients across cores, and a
+// device's sample ring stays in the cache of the core that both fills and drains it.
+class WorkerPool
+{
+public:
+    // Most workers a pool may have (--workers)
+    static constexpr size_t kMaxWorkers = 256;
+
+    explicit WorkerPool(size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            this->loops_.emplace_back(new EventLoop());
+            this->samplers_.emplace_back(new Sampler());
+            if (count > 1)
+            {
+                pin(this->samplers_.back()->native_handle(), i);
+            }
+        }
+    }
+
+    ~WorkerPool() { stop_samplers(); }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    size_t size() const { return this->loops_.size(); }
+    EventLoop &loop(size_t index) { return *this->loops_[index]; }
+    Sampler &sampler(size_t index) { return *this->samplers_[index]; }
+
+    // Stops every sampler thread; no device is sampled once this returns
+    void stop_samplers()
+    {
+        for (auto &sampler : this->samplers_)
+        {
+            sampler->shutdown();
+        }
+    }
+
+    // Runs task(index) for every worker index at once, each on a temporary thread pinned to that
+    // worker's core, and returns once all have finished. Meant for setup before run(): the loops are
+    // not running yet, and task must not touch them.
+    void run_on_each(const std::function<void(size_t)> &task)
+    {
+        if (this->loops_.size() == 1)
+        {
+            task(0);
+            return;
+        }
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < this->loops_.size(); i++)
+        {
+            threads.emplace_back([&task, i]
+                                 {
+                                     pin(pthread_self(), i);
+                                     task(i); });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    // Runs every loop until loop 0 is stopped, then stops and joins the others. SIGINT and SIGTERM
+    // stop loop 0, so the process shuts down cleanly (see block_shutdown_signals()).
+    void run()
+    {
+        sigset_t signals = shutdown_signals();
+        int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (signal_fd < 0)
+        {
+            LOG_ERROR("Error creating signal descriptor: %s", std::strerror(errno));
+        }
+        else
+        {
+            this->loops_[0]->add(signal_fd, [this, signal_fd]
+                                 {
+                                     signalfd_siginfo info;
+                                     while (read(signal_fd, &info, sizeof(info)) == static_cast<ssize_t>(sizeof(info)))
+                                     {
+                                     }
+                                     this->loops_[0]->stop();
+                                 });
+        }
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < this->loops_.size(); i++)
+        {
+            threads.emplace_back([this, i]
+                                 {
+                                     pin(pthread_self(), i);
+                                     this->loops_[i]->run(); });
+        }
+        if (this->loops_.size() > 1)
+        {
+            pin(pthread_self(), 0);
+        }
+        this->loops_[0]->run();
+
+        for (size_t i = 1; i < this->loops_.size(); i++)
+        {
+            EventLoop &loop = *this->loops_[i];
+            loop.post([&loop]
+                      { loop.stop(); });
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        if (signal_fd >= 0)
+        {
+            this->loops_[0]->remove(signal_fd);
+            close(signal_fd);
+        }
+    }
+
+    // Blocks SIGINT and SIGTERM in the calling thread and every thread it starts afterwards, leaving
+    // them to run()'s signalfd. Called first thing in main, before any thread exists.
+    static void block_shutdown_signals()
+    {
+        sigset_t signals = shutdown_signals();
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    }
+
+private:
+    // Member variables
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+    std::vector<std::unique_ptr<Sampler>> samplers_;
+
+    static sigset_t shutdown_signals()
+    {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        return signals;
+    }
+
+    // Pins thread to the core for worker index, wrapping around the available cores
+    static void pin(pthread_t thread, size_t index)
+    {
+        unsigned cores = std::thread::hardware_concurrency();
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cores == 0 ? 0 : index % cores, &cpus);
+        int error = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+        if (error != 0)
+        {
+            LOG_WARN("Could not pin worker %zu: %s", index, std::strerror(error));
+        }
+    }
+};
+
+// Protocol vocabulary: frame types, keys and values, fixed at compile time
+constexpr std::string_view kTypeId = "ID";
+constexpr std::string_view kTypeTest = "TEST";
+constexpr std::string_view kTypeStatus = "STATUS";
+constexpr std::string_view kTypeStats = "STATS";
+constexpr std::string_view kKeyModel = "MODEL";
+constexpr std::string_view kKeySerial = "SERIAL";
+constexpr std::string_view kKeyCmd = "CMD";
+constexpr std::string_view kKeyRate = "RATE";
+constexpr std::string_view kKeyDuration = "DURATION";
+constexpr std::string_view kKeyFormat = "FORMAT";
+constexpr std::string_view kKeyBatch = "BATCH";
+constexpr std::string_view kKeyLatency = "LATENCY";
+constexpr std::string_view kKeySignal = "SIGNAL";
+constexpr std::string_view kKeyChannels = "CHANNELS";
+constexpr std::string_view kKeyMulticast = "MCAST";
+constexpr std::string_view kKeyJitter = "JITTER";
+constexpr std::string_view kKeyFrom = "FROM";
+constexpr std::string_view kKeyTo = "TO";
+constexpr std::string_view kKeyCount = "COUNT";
+constexpr std::string_view kKeyNext = "NEXT";
+constexpr std::string_view kKeyReplay = "REPLAY";
+constexpr std::string_view kKeySeq = "SEQ";
+constexpr std::string_view kKeyFirst = "FIRST";
+constexpr std::string_view kKeyWindow = "WINDOW";
+constexpr std::string_view kKeyClock = "CLOCK";
+constexpr std::string_view kKeyAggregate = "AGG";
+constexpr std::string_view kKeyTimestamps = "TS";
+constexpr std::string_view kKeyTransmitted = "TX";
+constexpr std::string_view kKeyRequestsId = "REQ_ID";
+constexpr std::string_view kKeyRequestsTest = "REQ_TEST";
+constexpr std::string_view kKeyRequestsStats = "REQ_STATS";
+constexpr std::string_view kKeyRequestsOther = "REQ_INVALID";
+constexpr std::string_view kKeyFrames = "FRAMES";
+constexpr std::string_view kKeySamplesDropped = "SAMPLES_DROPPED";
+constexpr std::string_view kKeyTickJitter = "TICK_JITTER_NS";
+constexpr std::string_view kKeyEncodeTime = "ENCODE_NS";
+constexpr std::string_view kKeyDatagrams = "DATAGRAMS";
+constexpr std::string_view kKeySendFailed = "SEND_FAILED";
+constexpr std::string_view kKeySendPartial = "SEND_PARTIAL";
+constexpr std::string_view kKeySendDropped = "SEND_DROPPED";
+constexpr std::string_view kKeySendTime = "SEND_NS";
+constexpr std::string_view kKeyResult = "RESULT";
+constexpr std::string_view kKeyMsg = "MSG";
+constexpr std::string_view kKeyState = "STATE";
+constexpr std::string_view kKeyTime = "TIME";
+constexpr std::string_view kKeyMv = "MV";
+constexpr std::string_view kKeyMa = "MA";
+constexpr std::string_view kCmdStart = "START";
+constexpr std::string_view kCmdStop = "STOP";
+constexpr std::string_view kCmdSubscribe = "SUBSCRIBE";
+constexpr std::string_view kCmdUnsubscribe = "UNSUBSCRIBE";
+constexpr std::string_view kCmdFetch = "FETCH";
+constexpr std::string_view kCmdResend = "RESEND";
+constexpr std::string_view kCmdAck = "ACK";
+constexpr std::string_view kStateIdle = "IDLE";
+constexpr std::string_view kFormatText = "TEXT";
+constexpr std::string_view kFormatBinary = "BIN";
+constexpr std::string_view kClockMicro = "US";
+constexpr std::string_view kClockNano = "NS";
+constexpr std::string_view kAggregateMinMax = "MINMAX";
+constexpr std::string_view kStatSuffixes[] = {"_MIN", "_MAX", "", "_RMS"}; // of a summary's MIN, MAX, MEAN and RMS columns
+
+// FrameEncoder writes a "TYPE;KEY=VALUE;..." frame into its own fixed buffer (typically on the stack),
+// formatting numbers with std::to_chars, so encoding a frame never allocates
+class FrameEncoder
+{
+public:
+    static constexpr size_t kCapacity = 1472; // largest UDP payload in one Ethernet frame
+
+    // Constructor: starts a frame of the given type
+    explicit FrameEncoder(std::string_view type)
+    {
+        append(type);
+        put(';');
+    }
+
+    FrameEncoder(const FrameEncoder &) = delete;
+    FrameEncoder &operator=(const FrameEncoder &) = delete;
+
+    // Appends KEY=value;
+    FrameEncoder &add(std::string_view key, std::string_view value)
+    {
+        begin_field(key);
+        append(value);
+        put(';');
+        return *this;
+    }
+
+    // Appends KEY=value; for an integer value
+    FrameEncoder &add(std::string_view key, int64_t value)
+    {
+        begin_field(key);
+        append_int(value);
+        put(';');
+        return *this;
+    }
+
+    // Appends KEY=v0,v1,...; for a list of integers
+    FrameEncoder &add(std::string_view key, const int32_t *values, size_t count) { return add_list(key, values, count); }
+    FrameEncoder &add(std::string_view key, const int64_t *values, size_t count) { return add_list(key, values, count); }
+
+    // Appends KEY=value; for a millisecond count rendered as seconds with three decimals (1250 -> "1.250")
+    FrameEncoder &add_seconds(std::string_view key, int64_t millis)
+    {
+        return add_seconds(key, &millis, 1);
+    }
+
+    // Appends KEY=s0,s1,...; for a list of millisecond counts rendered as seconds
+    FrameEncoder &add_seconds(std::string_view key, const int64_t *millis, size_t count)
+    {
+        begin_field(key);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (i != 0)
+            {
+                put(',');
+            }
+            append_seconds(millis[i]);
+        }
+        put(';');
+        return *this;
+    }
+
+    std::string_view view() const { return std::string_view(this->buffer_, this->length_); }
+
+    // False if the frame did not fit in the buffer and was cut short
+    bool ok() const { return !this->overflow_; }
+
+private:
+    // Member variables
+    char buffer_[kCapacity];
+    size_t length_ = 0;
+    bool overflow_ = false;
+
+    void begin_field(std::string_view key)
+    {
+        append(key);
+        put('=');
+    }
+
+    template <typename T>
+    FrameEncoder &add_list(std::string_view key, const T *values, size_t count)
+    {
+        begin_field(key);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (i != 0)
+            {
+                put(',');
+            }
+            append_int(values[i]);
+        }
+        put(';');
+        return *this;
+    }
+
+    void put(char c)
+    {
+        if (this->length_ == kCapacity)
+        {
+            this->overflow_ = true;
+            return;
+        }
+        this->buffer_[this->length_++] = c;
+    }
+
+    void append(std::string_view text)
+    {
+        if (text.size() > kCapacity - this->length_)
+        {
+            this->overflow_ = true;
+            return;
+        }
+        memcpy(this->buffer_ + this->length_, text.data(), text.size());
+        this->length_ += text.size();
+    }
+
+    void append_int(int64_t value)
+    {
+        std::to_chars_result result = std::to_chars(this->buffer_ + this->length_, this->buffer_ + kCapacity, value);
+        if (result.ec != std::errc())
+        {
+            this->overflow_ = true;
+            return;
+        }
+        this->length_ = result.ptr - this->buffer_;
+    }
+
+    void append_seconds(int64_t millis)
+    {
+        if (millis < 0)
+        {
+            put('-');
+            millis = -millis;
+        }
+        append_int(millis / 1000);
+        put('.');
+        int64_t fraction = millis % 1000;
+        put(static_cast<char>('0' + fraction / 100));
+        put(static_cast<char>('0' + fraction / 10 % 10));
+        put(static_cast<char>('0' + fraction % 10));
+    }
+};
+
+// BinaryFrameEncoder writes the packed telemetry frame a client selects with TEST;CMD=START;FORMAT=BIN;
+//   header, 12 bytes: u8 marker (0x00), u8 version, u8 kind, u8 flags, u32 sequence, u16 sample count, u16 reserved
+//   sample, 8 bytes:  u32 TIME in ms, i16 MV, i16 MA
+// Devices with more than one channel send kind 2 (channel block) frames instead, which carry every channel
+// of count samples as one column per channel, and put the channel count in the reserved header field:
+//   u32 TIME[count], then i16 MV[count] for each channel in turn, then i16 MA[count] for each channel
+// Tests started with AGG send kind 3 (summary) frames: a channel block with MIN, MAX, MEAN and RMS columns
+// for each channel in turn, the reserved field holding the number of columns (4 per channel).
+// Frames of a test started with CLOCK go on after the samples, as the flags say (see FrameClock):
+//   flag 2: i64 TS[count], when each reading was taken; flag 4: u32 sequence and i64 TX of an earlier frame
+// Every field is little-endian, so clients decode with struct.unpack("<BBBBIHH")/("<Ihh") or numpy.frombuffer.
+// The leading NUL byte never starts a text frame, which is how a client tells the two apart.
+class BinaryFrameEncoder
+{
+public:
+    static constexpr uint8_t kMarker = 0x00;
+    static constexpr uint8_t kVersion = 1;
+    static constexpr uint8_t kKindStatus = 1;
+    static constexpr uint8_t kKindChannels = 2;
+    static constexpr uint8_t kKindSummary = 3;
+    static constexpr size_t kHeaderSize = 12;
+    static constexpr size_t kSampleSize = 8;
+    static constexpr size_t kCapacity = 1472; // largest UDP payload in one Ethernet frame
+
+    static constexpr uint8_t kFlagReplay = 1;      // read back from a capture, not live
+    static constexpr uint8_t kFlagTimestamps = 2;  // TS follows the samples
+    static constexpr uint8_t kFlagTransmitted = 4; // TX ends the frame
+    static constexpr size_t kTransmittedSize = 12;
+
+    // Constructor: starts a frame of the given kind, sequence number and flags with no samples
+    BinaryFrameEncoder(uint8_t kind, uint32_t sequence, uint8_t flags = 0) : sequence_(sequence)
+    {
+        this->buffer_[0] = kMarker;
+        this->buffer_[1] = kVersion;
+        this->buffer_[2] = kind;
+        this->buffer_[3] = flags;
+        store_u32(this->buffer_ + 4, sequence);
+        store_u16(this->buffer_ + 8, 0);
+        store_u16(this->buffer_ + 10, 0);
+    }
+
+    BinaryFrameEncoder(const BinaryFrameEncoder &) = delete;
+    BinaryFrameEncoder &operator=(const BinaryFrameEncoder &) = delete;
+
+    // Appends one sample; returns false if the frame is full
+    bool add_sample(uint32_t time_ms, int16_t millivolts, int16_t milliamps)
+    {
+        if (this->length_ + kSampleSize > kCapacity)
+        {
+            this->overflow_ = true;
+            return false;
+        }
+        uint8_t *sample = this->buffer_ + this->length_;
+        store_u32(sample, time_ms);
+        store_u16(sample + 4, static_cast<uint16_t>(millivolts));
+        store_u16(sample + 6, static_cast<uint16_t>(milliamps));
+        this->length_ += kSampleSize;
+        this->count_++;
+        store_u16(this->buffer_ + 8, this->count_);
+        return true;
+    }
+
+    // Fills a channel block frame with count samples of channels channels; channel c's values start at
+    // millivolts[c * stride] and milliamps[c * stride]. Returns false if they do not fit.
+    bool add_channel_block(const int64_t *time_ms, const int32_t *millivolts, const int32_t *milliamps,
+                           size_t count, size_t channels, size_t stride)
+    {
+        if (this->count_ != 0 || this->length_ + count * channel_sample_size(channels) > kCapacity)
+        {
+            this->overflow_ = true;
+            return false;
+        }
+        uint8_t *out = this->buffer_ + this->length_;
+        for (size_t i = 0; i < count; i++, out += 4)
+        {
+            store_u32(out, static_cast<uint32_t>(time_ms[i]));
+        }
+        for (const int32_t *column : {millivolts, milliamps})
+        {
+            for (size_t channel = 0; channel < channels; channel++)
+            {
+                const int32_t *values = column + channel * stride;
+                for (size_t i = 0; i < count; i++, out += 2)
+                {
+                    store_u16(out, static_cast<uint16_t>(values[i]));
+                }
+            }
+        }
+        this->length_ = static_cast<size_t>(out - this->buffer_);
+        this->count_ = static_cast<uint16_t>(count);
+        store_u16(this->buffer_ + 8, this->count_);
+        store_u16(this->buffer_ + 10, static_cast<uint16_t>(channels));
+        return true;
+    }
+
+    // Appends TS, one timestamp for each of the count samples already added; returns false if it does not fit
+    bool add_timestamps(const int64_t *timestamps, size_t count)
+    {
+        if (count != this->count_ || this->length_ + 8 * count > kCapacity)
+        {
+            this->overflow_ = true;
+            return false;
+        }
+        for (size_t i = 0; i < count; i++, this->length_ += 8)
+        {
+            store_u64(this->buffer_ + this->length_, static_cast<uint64_t>(timestamps[i]));
+        }
+        return true;
+    }
+
+    // Appends TX, the transmit time of frame sequence, last in the frame; returns false if it does not fit
+    bool add_transmitted(uint32_t sequence, int64_t time)
+    {
+        if (this->length_ + kTransmittedSize > kCapacity)
+        {
+            this->overflow_ = true;
+            return false;
+        }
+        store_u32(this->buffer_ + this->length_, sequence);
+        store_u64(this->buffer_ + this->length_ + 4, static_cast<uint64_t>(time));
+        this->length_ += kTransmittedSize;
+        return true;
+    }
+
+    // Bytes one sample of every channel takes in a channel block frame
+    static constexpr size_t channel_sample_size(size_t channels) { return 4 + 4 * channels; }
+
+    uint16_t sample_count() const { return this->count_; }
+
+    // False if anything added did not fit and was left out
+    bool ok() const { return !this->overflow_; }
+    uint32_t sequence() const { return this->sequence_; }
+
+    std::string_view view() const { return std::string_view(reinterpret_cast<const char *>(this->buffer_), this->length_); }
+
+private:
+    // Member variables
+    uint32_t sequence_;
+    uint8_t buffer_[kCapacity];
+    size_t length_ = kHeaderSize;
+    uint16_t count_ = 0;
+    bool overflow_ = false;
+
+    static void store_u16(uint8_t *out, uint16_t value)
+    {
+        out[0] = static_cast<uint8_t>(value);
+        out[1] = static_cast<uint8_t>(value >> 8);
+    }
+
+    static void store_u32(uint8_t *out, uint32_t value)
+    {
+        store_u16(out, static_cast<uint16_t>(value));
+        store_u16(out + 2, static_cast<uint16_t>(value >> 16));
+    }
+
+    static void store_u64(uint8_t *out, uint64_t value)
+    {
+        store_u32(out, static_cast<uint32_t>(value));
+        store_u32(out + 4, static_cast<uint32_t>(value >> 32));
+    }
+};
+
+// SampleBatch accumulates timestamped readings until they go out as one STATUS frame. Each quantity of
+// each channel is its own contiguous column, so frames are encoded straight from the arrays.
+struct SampleBatch
+{
+    // Most samples of channels channels that fit in one binary or text frame, with the TS and TX
+    // fields of a CLOCK test when stamped is set. For text, channels counts columns as the constructor
+    // does (kSummaryStats per device channel when summaries is set), and TIME values go up to
+    // max_time_ms; 0 means not even one sample fits.
+    static constexpr size_t max_binary(size_t channels, bool stamped = false)
+    {
+        return (BinaryFrameEncoder::kCapacity - BinaryFrameEncoder::kHeaderSize - (stamped ? BinaryFrameEncoder::kTransmittedSize : 0)) /
+               (BinaryFrameEncoder::channel_sample_size(channels) + (stamped ? 8 : 0));
+    }
+    static constexpr size_t max_text(size_t channels, bool stamped = false, bool summaries = false,
+                                     int64_t max_time_ms = kShortTestMs)
+    {
+        // 64 single channel samples of a short test keep a full text frame within FrameEncoder::kCapacity;
+        // a TS value takes up to 20 more characters, and TX a further 40 at most. Wider frames also spend
+        // the bytes of every column's MA and MV keys, which do not depend on the sample count.
+        size_t fixed = (stamped ? 104 : 64) + (channels == 1 ? 0 : text_key_bytes(channels, summaries));
+        size_t per_sample = 12 * channels + time_text_size(max_time_ms) + (stamped ? 20 : 0);
+        return fixed >= FrameEncoder::kCapacity ? 0 : (FrameEncoder::kCapacity - fixed) / per_sample;
+    }
+
+    // Longest test (in ms) whose TIME values take at most 10 characters each, the comma included
+    static constexpr int64_t kShortTestMs = 99999999;
+
+    // Characters of one TIME value of at most max_time_ms ("<seconds>.<ms>"), with the comma before it
+    static constexpr size_t time_text_size(int64_t max_time_ms)
+    {
+        size_t digits = 1;
+        for (int64_t seconds = max_time_ms / 1000; seconds >= 10; seconds /= 10)
+        {
+            digits++;
+        }
+        return digits + 5;
+    }
+
+    // Bytes the MA<c><suffix>= and MV<c><suffix>= keys of a multi-column text frame take, with the ';'
+    // ending each list (see DeviceServer::encode_batch())
+    static constexpr size_t text_key_bytes(size_t columns, bool summaries)
+    {
+        size_t stats = summaries ? kSummaryStats : 1;
+        size_t channels = columns / stats;
+        size_t bytes = 0;
+        for (size_t column = 0; column < columns; column++)
+        {
+            size_t channel = column / stats;
+            size_t digits = channels == 1 ? 0 : (channel < 10 ? 1 : (channel < 100 ? 2 : 3));
+            size_t suffix = summaries ? kStatSuffixes[column % stats].size() : 0;
+            bytes += 2 * (2 + digits + suffix + 2);
+        }
+        return bytes;
+    }
+
+    // Columns a batch of window summaries (see WindowAggregator) has for each device channel
+    static constexpr size_t kSummaryStats = 4;
+
+    // Constructor: a batch of readings of channels channels, or with summaries set, of window summaries
+    // taking channels columns: MIN, MAX, MEAN and RMS of each device channel in turn. The columns are
+    // left unallocated until allocate().
+    explicit SampleBatch(size_t channels, bool summaries = false)
+        : channels(channels), summaries(summaries), capacity(max_binary(channels)) {}
+
+    size_t channels;                 // columns per quantity
+    bool summaries;
+    size_t capacity;                 // column length
+    std::vector<int64_t> time_ms;
+    std::vector<int64_t> timestamps; // TS of each sample, in its test's ClockUnit
+    std::vector<int32_t> millivolts; // channel c's column starts at c * capacity
+    std::vector<int32_t> milliamps;
+    size_t count = 0;
+
+    // Allocates the columns on first use, so a device holds no batch storage until it is tested
+    void allocate()
+    {
+        if (this->time_ms.empty())
+        {
+            this->time_ms.resize(this->capacity);
+            this->timestamps.resize(this->capacity);
+            this->millivolts.resize(this->capacity * this->channels);
+            this->milliamps.resize(this->capacity * this->channels);
+        }
+    }
+
+    // Appends one sample of every channel
+    void push(int64_t time, const int32_t *mv, const int32_t *ma, int64_t timestamp = 0)
+    {
+        this->time_ms[this->count] = time;
+        this->timestamps[this->count] = timestamp;
+        for (size_t channel = 0; channel < this->channels; channel++)
+        {
+            this->millivolts[channel * this->capacity + this->count] = mv[channel];
+            this->milliamps[channel * this->capacity + this->count] = ma[channel];
+        }
+        this->count++;
+    }
+
+    const int32_t *millivolts_column(size_t channel) const { return &this->millivolts[channel * this->capacity]; }
+    const int32_t *milliamps_column(size_t channel) const { return &this->milliamps[channel * this->capacity]; }
+
+    bool empty() const { return this->count == 0; }
+    void clear() { this->count = 0; }
+
+    // Drops every sample whose time is not a multiple of step_ms, keeping the rest in order
+    void keep_multiples(int64_t step_ms)
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < this->count; i++)
+        {
+            if (this->time_ms[i] % step_ms != 0)
+            {
+                continue;
+            }
+            this->time_ms[kept] = this->time_ms[i];
+            this->timestamps[kept] = this->timestamps[i];
+            for (size_t channel = 0; channel < this->channels; channel++)
+            {
+                this->millivolts[channel * this->capacity + kept] = this->millivolts[channel * this->capacity + i];
+                this->milliamps[channel * this->capacity + kept] = this->milliamps[channel * this->capacity + i];
+            }
+            kept++;
+        }
+        this->count = kept;
+    }
+};
+
+// WindowAggregator folds a test's readings into summaries for TEST;CMD=START;AGG=MINMAX:<readings>:
+// the minimum, maximum, mean and RMS of every channel's MV and MA over each window of that many
+// readings. The statistics are updated as each reading arrives, so no window is ever held in memory.
+class WindowAggregator
+{
+public:
+    explicit WindowAggregator(size_t channels)
+        : channels_(channels), millivolts_(channels), milliamps_(channels),
+          row_millivolts_(SampleBatch::kSummaryStats * channels), row_milliamps_(SampleBatch::kSummaryStats * channels) {}
+
+    // Summarises every window readings from now on; 0 turns aggregation off
+    void reset(size_t window)
+    {
+        this->window_ = window;
+        this->count_ = 0;
+    }
+
+    bool active() const { return this->window_ != 0; }
+    bool empty() const { return this->count_ == 0; }
+
+    // Offset from the start of the test of the current window's first reading
+    int64_t start_ms() const { return this->start_ms_; }
+
+    // Adds one reading of every channel, taken at time_ms (and timestamp); returns true once it completes a window
+    bool add(int64_t time_ms, int64_t timestamp, const int32_t *millivolts, const int32_t *milliamps)
+    {
+        if (this->count_ == 0)
+        {
+            this->start_ms_ = time_ms;
+            this->timestamp_ = timestamp;
+        }
+        bool first = this->count_ == 0;
+        for (size_t channel = 0; channel < this->channels_; channel++)
+        {
+            this->millivolts_[channel].add(millivolts[channel], first);
+            this->milliamps_[channel].add(milliamps[channel], first);
+        }
+        return ++this->count_ == this->window_;
+    }
+
+    // Appends the summary of the current window to out, a batch of summaries, and starts the next window.
+    // The summary carries the time (and timestamp) of the window's first reading.
+    void flush(SampleBatch &out)
+    {
+        for (size_t channel = 0; channel < this->channels_; channel++)
+        {
+            this->millivolts_[channel].summarise(this->count_, &this->row_millivolts_[SampleBatch::kSummaryStats * channel]);
+            this->milliamps_[channel].summarise(this->count_, &this->row_milliamps_[SampleBatch::kSummaryStats * channel]);
+        }
+        out.push(this->start_ms_, this->row_millivolts_.data(), this->row_milliamps_.data(), this->timestamp_);
+        this->count_ = 0;
+    }
+
+    // Drops the current window without summarising it
+    void discard() { this->count_ = 0; }
+
+private:
+    // Running statistics of one channel's quantity over the current window
+    struct Accumulator
+    {
+        int32_t min;
+        int32_t max;
+        int64_t sum;
+        int64_t sum_squares;
+
+        void add(int32_t value, bool first)
+        {
+            if (first)
+            {
+                this->min = this->max = value;
+                this->sum = this->sum_squares = 0;
+            }
+            this->min = value < this->min ? value : this->min;
+            this->max = value > this->max ? value : this->max;
+            this->sum += value;
+            this->sum_squares += static_cast<int64_t>(value) * value;
+        }
+
+        // Writes MIN, MAX, MEAN and RMS over count readings to out, the mean and RMS rounded
+        void summarise(size_t count, int32_t *out) const
+        {
+            double n = static_cast<double>(count);
+            out[0] = this->min;
+            out[1] = this->max;
+            out[2] = static_cast<int32_t>(std::lround(static_cast<double>(this->sum) / n));
+            out[3] = static_cast<int32_t>(std::lround(std::sqrt(static_cast<double>(this->sum_squares) / n)));
+        }
+    };
+
+    // Member variables
+    size_t channels_;
+    size_t window_ = 0;
+    size_t count_ = 0;
+    int64_t start_ms_ = 0;
+    int64_t timestamp_ = 0;
+    std::vector<Accumulator> millivolts_;
+    std::vector<Accumulator> milliamps_;
+    std::vector<int32_t> row_millivolts_; // the summary being flushed, laid out as SampleBatch::push() reads it
+    std::vector<int32_t> row_milliamps_;
+};
+
+// CaptureFile records every reading of one test into a memory-mapped columnar file, so that a test can
+// be fetched back after the fact. The file is sized for the whole test when it starts and written with
+// plain stores, never a syscall per sample. Layout, in native byte order:
+//   header, 64 bytes: char[8] magic "SDCAP1", u32 channels, u32 rate in ms, u32 capacity (samples),
+//                     u32 count (1 + highest sample index written), i32 serial, u32 reserved, char[32] model
+//   then these columns, each starting on an 8 byte boundary:
+//     u8 present[capacity], u32 TIME[capacity] in ms,
+//     i16 MV[capacity] for each channel in turn, i16 MA[capacity] for each channel in turn
+// Sample i is the reading due at i * rate; readings lost to a full sample ring stay marked absent.
+class CaptureFile
+{
+public:
+    static constexpr size_t kHeaderSize = 64;
+    static constexpr size_t kMaxSamples = size_t(1) << 24; // longer tests are captured up to this many samples
+    static constexpr size_t kMaxBytes = size_t(256) << 20;  // and up to as many as fit in a file this large
+    static constexpr int64_t kMaxTimeMs = UINT32_MAX;       // sample times are stored in 32 bits of ms
+
+    CaptureFile() = default;
+    ~CaptureFile() { close_file(); }
+
+    CaptureFile(const CaptureFile &) = delete;
+    CaptureFile &operator=(const CaptureFile &) = delete;
+
+    // Creates (or replaces) the capture at path for a test of samples readings every rate of device,
+    // keeping the first kMaxSamples of them at most, and fewer with many channels (see kMaxBytes).
+    // Returns false (logging why) if the file cannot be created.
+    bool create(const std::string &path, const Device &device, std::chrono::milliseconds rate, size_t samples)
+    {
+        close_file();
+        this->channels_ = device.channels();
+        this->rate_ms_ = rate.count();
+        size_t limit = (kMaxBytes - kHeaderSize - 32) / (5 + 4 * this->channels_); // 32: column alignment
+        limit = limit < kMaxSamples ? limit : kMaxSamples;
+        this->capacity_ = samples < limit ? samples : limit;
+        if (this->capacity_ < samples)
+        {
+            LOG_WARN("Capturing only the first %zu of %zu readings into %s", this->capacity_, samples, path.c_str());
+        }
+        this->time_offset_ = align(kHeaderSize + this->capacity_);
+        this->millivolts_offset_ = align(this->time_offset_ + 4 * this->capacity_);
+        this->milliamps_offset_ = align(this->millivolts_offset_ + 2 * this->capacity_ * this->channels_);
+        this->size_ = align(this->milliamps_offset_ + 2 * this->capacity_ * this->channels_);
+
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(this->size_)) < 0)
+        {
+            LOG_ERROR("Error creating capture file %s: %s", path.c_str(), std::strerror(errno));
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return false;
+        }
+        void *data = mmap(nullptr, this->size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd); // the mapping keeps the file open
+        if (data == MAP_FAILED)
+        {
+            LOG_ERROR("Error mapping capture file: %s", std::strerror(errno));
+            return false;
+        }
+        this->data_ = static_cast<uint8_t *>(data);
+
+        std::memcpy(this->data_, "SDCAP1\0\0", 8);
+        store32(8, static_cast<uint32_t>(this->channels_));
+        store32(12, static_cast<uint32_t>(this->rate_ms_));
+        store32(16, static_cast<uint32_t>(this->capacity_));
+        store32(20, 0);
+        store32(24, static_cast<uint32_t>(device.serial_number()));
+        std::memcpy(this->data_ + 32, device.model().data(), device.model().size() < 32 ? device.model().size() : 31);
+        this->count_ = 0;
+        return true;
+    }
+
+    bool is_open() const { return this->data_ != nullptr; }
+    std::chrono::milliseconds rate() const { return std::chrono::milliseconds{this->rate_ms_}; }
+    size_t count() const { return this->count_; }
+
+    // Stores the reading due at time_ms (channels() values per quantity); readings past capacity are not kept
+    void record(int64_t time_ms, const int32_t *millivolts, const int32_t *milliamps)
+    {
+        size_t index = static_cast<size_t>(time_ms / this->rate_ms_);
+        if (this->data_ == nullptr || index >= this->capacity_)
+        {
+            return;
+        }
+        this->data_[kHeaderSize + index] = 1;
+        uint32_t time = static_cast<uint32_t>(time_ms);
+        std::memcpy(this->data_ + this->time_offset_ + 4 * index, &time, 4);
+        int16_t *mv = column(this->millivolts_offset_);
+        int16_t *ma = column(this->milliamps_offset_);
+        for (size_t channel = 0; channel < this->channels_; channel++)
+        {
+            mv[channel * this->capacity_ + index] = static_cast<int16_t>(millivolts[channel]);
+            ma[channel * this->capacity_ + index] = static_cast<int16_t>(milliamps[channel]);
+        }
+        if (index >= this->count_)
+        {
+            this->count_ = index + 1;
+            store32(20, static_cast<uint32_t>(this->count_));
+        }
+    }
+
+    // Asks the kernel to start writing the test's pages back, without waiting for it
+    void finish()
+    {
+        if (this->data_ != nullptr && msync(this->data_, this->size_, MS_ASYNC) < 0)
+        {
+            LOG_ERROR("Error flushing capture file: %s", std::strerror(errno));
+        }
+    }
+
+    // Reads sample index into a batch; returns false if it was never recorded
+    bool read(size_t index, SampleBatch &batch) const
+    {
+        if (this->data_ == nullptr || index >= this->count_ || this->data_[kHeaderSize + index] == 0)
+        {
+            return false;
+        }
+        uint32_t time;
+        std::memcpy(&time, this->data_ + this->time_offset_ + 4 * index, 4);
+        const int16_t *mv = reinterpret_cast<const int16_t *>(this->data_ + this->millivolts_offset_);
+        const int16_t *ma = reinterpret_cast<const int16_t *>(this->data_ + this->milliamps_offset_);
+        int32_t millivolts[Device::kMaxChannels];
+        int32_t milliamps[Device::kMaxChannels];
+        for (size_t channel = 0; channel < this->channels_; channel++)
+        {
+            millivolts[channel] = mv[channel * this->capacity_ + index];
+            milliamps[channel] = ma[channel * this->capacity_ + index];
+        }
+        batch.push(time, millivolts, milliamps);
+        return true;
+    }
+
+private:
+    // Member variables
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    size_t channels_ = 1;
+    int64_t rate_ms_ = 1;
+    size_t capacity_ = 0;
+    size_t count_ = 0;
+    size_t time_offset_ = 0;
+    size_t millivolts_offset_ = 0;
+    size_t milliamps_offset_ = 0;
+
+    static size_t align(size_t offset) { return (offset + 7) & ~static_cast<size_t>(7); }
+
+    int16_t *column(size_t offset) { return reinterpret_cast<int16_t *>(this->data_ + offset); }
+
+    void store32(size_t offset, uint32_t value) { std::memcpy(this->data_ + offset, &value, 4); }
+
+    void close_file()
+    {
+        if (this->data_ != nullptr)
+        {
+            if (munmap(this->data_, this->size_) < 0)
+            {
+                LOG_ERROR("Error unmapping capture file: %s", std::strerror(errno));
+            }
+            this->data_ = nullptr;
+        }
+    }
+};
+
+// RetransmitRing keeps the last kFrames STATUS frames of a test, byte for byte, so that a client that
+// noticed a gap in the sequence numbers can ask for the missing frames again (TEST;CMD=RESEND).
+// The storage is only allocated once the first frame is kept.
+class RetransmitRing
+{
+public:
+    static constexpr size_t kFrames = 256;
+    static constexpr size_t kFrameSize = 1472; // FrameEncoder::kCapacity and BinaryFrameEncoder::kCapacity
+
+    // Forgets every frame; the next test starts again from sequence 0
+    void clear() { this->next_ = 0; }
+
+    // Keeps frame as the one with the given sequence number; frames are kept in sequence order
+    void store(uint32_t sequence, std::string_view frame)
+    {
+        if (this->storage_.empty())
+        {
+            this->storage_.resize(kFrames * kFrameSize);
+        }
+        size_t slot = sequence % kFrames;
+        size_t length = frame.size() < kFrameSize ? frame.size() : kFrameSize;
+        std::memcpy(this->storage_.data() + slot * kFrameSize, frame.data(), length);
+        this->lengths_[slot] = static_cast<uint16_t>(length);
+        this->next_ = sequence + 1;
+    }
+
+    // Sequence number of the oldest frame still kept (equal to end() when none is)
+    uint32_t begin() const { return this->next_ < kFrames ? 0 : this->next_ - static_cast<uint32_t>(kFrames); }
+
+    // One past the sequence number of the newest frame kept
+    uint32_t end() const { return this->next_; }
+
+    // The frame with the given sequence number, which must be in [begin(), end())
+    std::string_view frame(uint32_t sequence) const
+    {
+        size_t slot = sequence % kFrames;
+        return std::string_view(this->storage_.data() + slot * kFrameSize, this->lengths_[slot]);
+    }
+
+private:
+    // Member variables
+    std::vector<char> storage_;
+    uint16_t lengths_[kFrames] = {};
+    uint32_t next_ = 0;
+};
+
+// Request types and TEST commands, resolved once at parse time so dispatch never compares strings
+enum class RequestType
+{
+    Unknown,
+    Id,
+    Test,
+    Stats
+};
+
+enum class TestCommand
+{
+    None,
+    Unknown,
+    Start,
+    Stop,
+    Subscribe,
+    Unsubscribe,
+    Fetch,
+    Resend,
+    Ack
+};
+
+// Request is a parsed "TYPE;KEY=VALUE;..." message. Every field is a string_view slice into the
+// receive buffer, kept in a fixed-capacity table, so parsing and lookups never allocate.
+class Request
+{
+public:
+    static constexpr size_t kMaxFields = 16;
+
+    // Parses message in place; returns false (logging why) if it is malformed.
+    // The views stay valid only as long as the buffer behind message does.
+    bool parse(std::string_view message)
+    {
+        this->type_name_ = std::string_view();
+        this->type_ = RequestType::Unknown;
+        this->command_ = TestCommand::None;
+        this->field_count_ = 0;
+        if (message.empty())
+        {
+            return false;
+        }
+
+        size_t pos = 0;
+        bool first_segment = true;
+        while (pos < message.size())
+        {
+            size_t end = message.find(';', pos);
+            if (end == std::string_view::npos)
+            {
+                end = message.size();
+            }
+            std::string_view segment = message.substr(pos, end - pos);
+            pos = end + 1;
+
+            if (first_segment)
+            {
+                this->type_name_ = segment;
+                first_segment = false;
+                continue;
+            }
+
+            size_t delimiter_position = segment.find('=');
+            if (delimiter_position == std::string_view::npos)
+            {
+                LOG_WARN("Invalid message format: Missing \"=\" in a segment.");
+                return false;
+            }
+            if (this->field_count_ == kMaxFields)
+            {
+                LOG_WARN("Invalid message format: Too many segments.");
+                return false;
+            }
+            this->fields_[this->field_count_++] = {segment.substr(0, delimiter_position),
+                                                   segment.substr(delimiter_position + 1)};
+        }
+
+        if (this->type_name_ == kTypeId)
+        {
+            this->type_ = RequestType::Id;
+        }
+        else if (this->type_name_ == kTypeTest)
+        {
+            this->type_ = RequestType::Test;
+        }
+        else if (this->type_name_ == kTypeStats)
+        {
+            this->type_ = RequestType::Stats;
+        }
+
+        std::string_view cmd;
+        if (get(kKeyCmd, cmd))
+        {
+            if (cmd == kCmdStart)
+            {
+                this->command_ = TestCommand::Start;
+            }
+            else if (cmd == kCmdStop)
+            {
+                this->command_ = TestCommand::Stop;
+            }
+            else if (cmd == kCmdSubscribe)
+            {
+                this->command_ = TestCommand::Subscribe;
+            }
+            else if (cmd == kCmdUnsubscribe)
+            {
+                this->command_ = TestCommand::Unsubscribe;
+            }
+            else if (cmd == kCmdFetch)
+            {
+                this->command_ = TestCommand::Fetch;
+            }
+            else if (cmd == kCmdResend)
+            {
+                this->command_ = TestCommand::Resend;
+            }
+            else if (cmd == kCmdAck)
+            {
+                this->command_ = TestCommand::Ack;
+            }
+            else
+            {
+                this->command_ = TestCommand::Unknown;
+            }
+        }
+        return true;
+    }
+
+    RequestType type() const { return this->type_; }
+    TestCommand command() const { return this->command_; }
+
+    // Looks up the value of key (the last occurrence wins); returns false if it is absent
+    bool get(std::string_view key, std::string_view &value) const
+    {
+        for (size_t i = this->field_count_; i > 0; i--)
+        {
+            if (this->fields_[i - 1].key == key)
+            {
+                value = this->fields_[i - 1].value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool has(std::string_view key) const
+    {
+        std::string_view value;
+        return get(key, value);
+    }
+
+    // Looks up key and parses its leading integer (so "5.0" reads as 5); returns false if absent or not numeric
+    bool get_int(std::string_view key, int &value) const
+    {
+        std::string_view text;
+        if (!get(key, text))
+        {
+            return false;
+        }
+        return std::from_chars(text.data(), text.data() + text.size(), value).ec == std::errc();
+    }
+
+private:
+    struct Field
+    {
+        std::string_view key;
+        std::string_view value;
+    };
+
+    // Member variables
+    std::string_view type_name_;
+    RequestType type_ = RequestType::Unknown;
+    TestCommand command_ = TestCommand::None;
+    Field fields_[kMaxFields];
+    size_t field_count_ = 0;
+};
+
+// Encoding of the STATUS stream of a test
+enum class FrameFormat
+{
+    Text,
+    Binary
+};
+
+// Unit of the timestamps a test started with CLOCK=US or CLOCK=NS sends (see FrameClock)
+enum class ClockUnit
+{
+    None, // no CLOCK: no timestamps
+    Micro,
+    Nano
+};
+
+// FrameClock holds the timestamps of a CLOCK test's STATUS frames, all on the realtime_ns() clock in
+// the test's unit. Every live frame carries TS, when each of its readings was actually taken, and TX,
+// when the kernel sent the latest earlier frame that has not been reported yet (SO_TIMESTAMPING).
+struct FrameClock
+{
+    ClockUnit unit = ClockUnit::None;
+    bool has_transmitted = false; // a TX no frame has carried yet
+    uint32_t transmitted_sequence = 0;
+    int64_t transmitted_time = 0;
+    uint32_t next_stamped = 0; // frames before this one have had their TX recorded
+
+    bool enabled() const { return this->unit != ClockUnit::None; }
+
+    // Converts a realtime_ns() timestamp to unit
+    int64_t convert(int64_t ns) const { return this->unit == ClockUnit::Micro ? ns / 1000 : ns; }
+};
+
+// TestOptions holds the parameters of a TEST;CMD=START request
+struct TestOptions
+{
+    std::chrono::milliseconds rate{0};
+    std::chrono::seconds duration{0};
+    FrameFormat format = FrameFormat::Text;
+    size_t batch = 1;                        // samples per STATUS frame
+    std::chrono::milliseconds max_latency{0}; // send a partial batch once its oldest sample is this old (0 = never)
+    std::shared_ptr<const SignalModel> signal; // nullptr = the device's own signal model
+    size_t window = 0;                         // frames the client takes ahead of its ACKs (0 = no pacing)
+    ClockUnit clock = ClockUnit::None;         // unit of the frames' TS and TX timestamps
+    size_t aggregate = 0;                      // readings summarised per window (0 = send every reading)
+
+    // Latest TIME (in ms) a STATUS frame of the test may carry: the last reading is due by DURATION + RATE
+    int64_t max_time_ms() const
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(this->duration).count() + this->rate.count();
+    }
+
+    // Reads RATE, DURATION and the optional FORMAT, CLOCK, AGG, BATCH, LATENCY, SIGNAL and WINDOW from request;
+    // returns false if any is missing or invalid. BATCH is capped at what fits in one frame of channels channels.
+    bool parse(const Request &request, size_t channels)
+    {
+        int rate_ms, duration_s;
+        if (!request.get_int(kKeyRate, rate_ms) || !request.get_int(kKeyDuration, duration_s))
+        {
+            return false;
+        }
+        this->rate = std::chrono::milliseconds{rate_ms};
+        this->duration = std::chrono::seconds{duration_s};
+
+        std::string_view frame_format;
+        if (request.get(kKeyFormat, frame_format))
+        {
+            if (frame_format == kFormatBinary)
+            {
+                this->format = FrameFormat::Binary;
+            }
+            else if (frame_format != kFormatText)
+            {
+                return false;
+            }
+        }
+        std::string_view clock_unit;
+        if (request.get(kKeyClock, clock_unit))
+        {
+            if (clock_unit != kClockMicro && clock_unit != kClockNano)
+            {
+                return false;
+            }
+            this->clock = clock_unit == kClockMicro ? ClockUnit::Micro : ClockUnit::Nano;
+        }
+        std::string_view aggregate_spec;
+        if (request.get(kKeyAggregate, aggregate_spec))
+        {
+            // MINMAX:<readings per window>
+            size_t colon = aggregate_spec.find(':');
+            if (colon == std::string_view::npos || aggregate_spec.substr(0, colon) != kAggregateMinMax)
+            {
+                return false;
+            }
+            const char *end = aggregate_spec.data() + aggregate_spec.size();
+            int readings = 0;
+            std::from_chars_result result = std::from_chars(aggregate_spec.data() + colon + 1, end, readings);
+            if (result.ec != std::errc() || result.ptr != end || readings < 1)
+            {
+                return false;
+            }
+            this->aggregate = static_cast<size_t>(readings);
+        }
+        bool stamped = this->clock != ClockUnit::None;
+        size_t columns = this->aggregate > 0 ? channels * SampleBatch::kSummaryStats : channels;
+        size_t max_batch = this->format == FrameFormat::Binary ? SampleBatch::max_binary(columns, stamped)
+                                                               : SampleBatch::max_text(columns, stamped, this->aggregate > 0, max_time_ms());
+        if (max_batch == 0)
+        {
+            return false; // not even one reading or summary of this many channels, this late, fits in a text frame
+        }
+
+        int value;
+        if (request.has(kKeyBatch))
+        {
+            if (!request.get_int(kKeyBatch, value) || value < 1)
+            {
+                return false;
+            }
+            this->batch = static_cast<size_t>(value) < max_batch ? static_cast<size_t>(value) : max_batch;
+        }
+        if (request.has(kKeyLatency))
+        {
+            if (!request.get_int(kKeyLatency, value) || value < 0)
+            {
+                return false;
+            }
+            this->max_latency = std::chrono::milliseconds{value};
+        }
+        if (request.has(kKeyWindow))
+        {
+            if (!request.get_int(kKeyWindow, value) || value < 0)
+            {
+                return false;
+            }
+            this->window = static_cast<size_t>(value);
+        }
+
+        std::string_view signal_spec;
+        if (request.get(kKeySignal, signal_spec))
+        {
+            this->signal = make_signal_model(signal_spec, false);
+            if (this->signal == nullptr)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// DeviceServer class represents a UDP server that communicates with clients to control and monitor the Device
+class DeviceServer
+{
+    friend struct DeviceServerBench;
+    friend struct DeviceServerCheck;
+
+public:
+    // Constructor: initializes the server with the given port number and a reference to a device
+    DeviceServer(int port, Device &device)
+        : port_(port), device_(device), test_timer_([this]
+                                                     { this->on_transmit_tick(); }),
+          sampling_job_(device), readings_(device.channels()),
+          summaries_(device.channels() * SampleBatch::kSummaryStats, true), aggregator_(device.channels()), fetched_(device.channels()),
+          discovery_timer_([this]
+                           { this->send_id(this->discovery_client_, *this->loop_, this->server_fd_); }),
+          jitter_rng_(static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+                      static_cast<uint64_t>(port) << 32)
+    {
+        this->test_subscribers_.reserve(kMaxSubscribers);
+        this->server_addr_.sin_family = AF_INET;
+        this->server_addr_.sin_addr.s_addr = htonl(INADDR_ANY);
+        this->server_addr_.sin_port = htons(port);
+    }
+
+    ~DeviceServer()
+    {
+        detach_loop();
+        if (this->server_fd_ >= 0)
+        {
+            close(this->server_fd_);
+        }
+        for (auto &shard : this->shards_)
+        {
+            close(shard->fd);
+        }
+    }
+
+    DeviceServer(const DeviceServer &) = delete;
+    DeviceServer &operator=(const DeviceServer &) = delete;
+
+    // Captures every test's readings into a file in dir (see CaptureFile). Must be called before open().
+    void set_capture_dir(const std::string &dir) { this->capture_dir_ = dir; }
+
+    // Publishes STATUS frames (readings and IDLE) to the given multicast group instead of to each
+    // subscriber; TEST responses still go to the client that asked. Must be called before open().
+    void set_multicast(const sockaddr_in &group)
+    {
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &group.sin_addr, address, sizeof(address));
+        this->multicast_addr_ = group;
+        this->multicast_name_ = std::string(address) + ":" + std::to_string(ntohs(group.sin_port));
+    }
+
+    // Binds the server socket and, with shards set, that many more sockets sharing its port through
+    // SO_REUSEPORT for other workers to serve (see attach_shard()). Touches no event loop, so the
+    // servers of a host may be bound from several threads at once.
+    bool bind_sockets(size_t shards = 0)
+    {
+        this->server_fd_ = bind_socket(shards > 0);
+        if (this->server_fd_ < 0)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < shards; i++)
+        {
+            int fd = bind_socket(true);
+            if (fd < 0)
+            {
+                return false;
+            }
+            this->shards_.emplace_back(new Shard(fd));
+        }
+        return true;
+    }
+
+    // Registers the bound server socket with the given event loop; tests take their readings on sampler
+    bool attach(EventLoop &loop, Sampler &sampler)
+    {
+        if (this->server_fd_ < 0 || !loop.add(this->server_fd_, [this]
+                                               { this->listen(); }))
+        {
+            return false;
+        }
+        this->loop_ = &loop;
+        this->sampler_ = &sampler;
+        LOG_INFO("Server running and listening on port %d", this->port_);
+        return true;
+    }
+
+    // Serves bound shard socket index from another worker's loop. ID requests are answered on that
+    // worker; the rest are handed to the server's own loop, which owns all test state.
+    bool attach_shard(size_t index, EventLoop &loop)
+    {
+        Shard *shard = this->shards_[index].get();
+        if (!loop.add(shard->fd, [this, shard]
+                      { this->listen_shard(*shard); }))
+        {
+            return false;
+        }
+        shard->loop = &loop;
+        return true;
+    }
+
+    // Binds the server socket alone and registers it with loop
+    bool open(EventLoop &loop, Sampler &sampler) { return bind_sockets() && attach(loop, sampler); }
+
+    // Starts the server and listens for incoming requests, on workers threads sharing the port,
+    // also answering fleet scans on the discovery endpoint if one is given
+    void start(size_t workers = 1, const sockaddr_in *discovery = nullptr);
+
+    // Answers a discovery scan from client_addr with the ID response after a random delay of up to
+    // window, so a fleet's replies reach the scanner spread out instead of as one burst. A second
+    // scan arriving before the reply has gone out is answered by that same reply.
+    void answer_discovery(const sockaddr_in &client_addr, std::chrono::milliseconds window)
+    {
+        this->discovery_client_ = client_addr;
+        if (this->discovery_timer_.scheduled())
+        {
+            return;
+        }
+        uint64_t delay_us = window.count() <= 0 ? 0 : this->jitter_rng_.next() % (static_cast<uint64_t>(window.count()) * 1000);
+        this->loop_->schedule(this->discovery_timer_, std::chrono::steady_clock::now() + std::chrono::microseconds{delay_us});
+    }
+
+    bool is_open() const { return this->loop_ != nullptr; }
+
+private:
+    // Member variables
+    int port_;
+    Device &device_;
+    sockaddr_in server_addr_;
+    int server_fd_ = -1;
+    EventLoop *loop_ = nullptr;
+    Sampler *sampler_ = nullptr;
+    bool test_running_ = false;
+    bool test_stopping_ = false; // STOP received, waiting for the sampler to let go of the test
+    sockaddr_in stop_client_{}; // the client whose STOP is waiting, answered by finish_stop()
+    static constexpr size_t kMaxSubscribers = 32;
+    sockaddr_in multicast_addr_{};  // sin_family stays 0 unless set_multicast() was called
+    std::string multicast_name_;    // "group:port", as reported by ID
+    TimerWheel::Timer test_timer_; // fires on every transmit tick while a test is running
+    Sampler::Job sampling_job_;
+    uint32_t test_generation_ = 0; // samples tagged with any other generation belong to an earlier test
+    std::vector<sockaddr_in> test_subscribers_; // every client the test's STATUS frames go to, the starter first
+    sockaddr_in test_starter_{}; // the client that started the running test, the only one that paces it (sin_family 0 when none)
+    std::chrono::steady_clock::time_point test_start_time_;
+    std::chrono::milliseconds test_transmit_period_{0};
+    std::chrono::milliseconds test_transmit_lag_{0};
+    int64_t test_tick_ = 0; // index of the next transmit tick
+    FrameFormat test_format_ = FrameFormat::Text;
+    uint32_t test_sequence_ = 0; // sequence number of the next STATUS frame
+    RetransmitRing sent_frames_;  // the test's latest STATUS frames, for RESEND
+
+    // Counters reported by STATS; requests are counted on whichever worker received them
+    struct ServerStats
+    {
+        std::atomic<uint64_t> requests[4] = {}; // by RequestType
+        std::atomic<uint64_t> malformed{0};     // did not parse
+        Histogram tick_jitter;                  // transmit tick lateness, this test
+        Histogram encode_time;                  // time to encode a STATUS frame, this test
+    };
+    ServerStats stats_;
+    size_t test_batch_ = 1;
+    std::chrono::milliseconds test_max_latency_{0};
+    int64_t test_step_ms_ = 1;     // time between the entries of the pending batch: RATE, or a whole AGG window
+    size_t test_frame_limit_ = 1;  // most samples one STATUS frame of the test's format holds
+    size_t test_window_ = 0;       // frames the starter may have outstanding (0 = no pacing)
+    uint32_t test_acked_ = 0;      // one past the last frame the starter acknowledged
+    int64_t test_decimation_ = 1;  // only every test_decimation_-th reading is sent while paced
+    FrameClock test_clock_;        // timestamps of a CLOCK test
+    bool tx_stamps_enabled_ = false;
+    static constexpr int64_t kMaxDecimation = 64;
+    std::chrono::steady_clock::time_point test_last_flush_;
+    static constexpr std::chrono::milliseconds kPacingProbe{250}; // longest silence while the window is full
+    SampleBatch readings_;   // readings taken but not yet sent
+    SampleBatch summaries_;  // window summaries of an AGG test not yet sent
+    SampleBatch *pending_ = &readings_; // whichever of the two the current test sends
+    WindowAggregator aggregator_;
+    Request request_;       // reused for every received request
+    std::string capture_dir_; // every test is captured into this directory when set
+    CaptureFile capture_;     // capture of the current (or last) test
+    SampleBatch fetched_;     // readings being read back from capture_
+    static constexpr size_t kMaxFetchFrames = 64;
+    TimerWheel::Timer discovery_timer_; // sends a delayed discovery reply to discovery_client_
+    sockaddr_in discovery_client_;
+    MeasurementRng jitter_rng_;
+
+    // A request received on a shard socket, waiting for the server's own loop. Every request of the
+    // protocol fits in kMaxForwarded bytes.
+    static constexpr size_t kMaxForwarded = 256;
+    struct ForwardedRequest
+    {
+        sockaddr_in client_addr;
+        size_t length;
+        char text[kMaxForwarded];
+    };
+
+    // An extra socket of the port's SO_REUSEPORT group, served from another worker's loop
+    struct Shard
+    {
+        explicit Shard(int fd) : fd(fd) {}
+
+        EventLoop *loop = nullptr;
+        int fd;
+        Request request; // reused for every request received on fd
+        SpscRing<ForwardedRequest, 32> forwarded; // filled on the shard's worker, drained on the server's
+    };
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    // A stopping test still counts as running until STOPPED has been sent
+    bool test_running() const { return this->test_running_ || this->test_stopping_; }
+
+    // Cancels any running test and unregisters the server socket from its event loop
+    void detach_loop()
+    {
+        if (this->loop_ == nullptr)
+        {
+            return;
+        }
+        if (this->test_running_)
+        {
+            this->sampler_->stop(this->sampling_job_);
+        }
+        stop_timer();
+        this->test_stopping_ = false;
+        this->loop_->cancel(this->discovery_timer_);
+        this->loop_->remove(this->server_fd_);
+        this->loop_ = nullptr;
+        for (auto &shard : this->shards_)
+        {
+            if (shard->loop != nullptr)
+            {
+                shard->loop->remove(shard->fd); // the workers have stopped by now
+            }
+        }
+    }
+
+    // Creates the server socket and binds it to the port; returns -1 (logging why) on failure
+    int bind_socket(bool share_port)
+    {
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int enable = 1;
+        if (fd < 0 || (share_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) ||
+            bind(fd, (sockaddr *)&server_addr_, sizeof(server_addr_)) < 0)
+        {
+            LOG_ERROR("Error initializing server on port %d: %s", ntohs(this->server_addr_.sin_port), std::strerror(errno));
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return -1;
+        }
+        return fd;
+    }
+
+    // Handles the requests arriving on the server's own socket
+    void listen()
+    {
+        receive_requests(this->server_fd_, this->loop_->recv_batch(), this->request_,
+                         [this](const Request &request, std::string_view, const sockaddr_in &client_addr)
+                         { fulfill_request(request, client_addr); });
+    }
+
+    // Handles the requests arriving on a shard socket, on that shard's worker thread. Only ID is
+    // answered here: it reads nothing but the device's fixed description. Everything else is copied
+    // into the shard's ring for the server's own loop, which is woken once per received batch. A
+    // request that finds the ring full is dropped, as the kernel drops one that finds the socket full.
+    void listen_shard(Shard &shard)
+    {
+        bool forwarded = false;
+        receive_requests(shard.fd, shard.loop->recv_batch(), shard.request,
+                         [this, &shard, &forwarded](const Request &request, std::string_view raw, const sockaddr_in &client_addr)
+                         {
+                             if (request.type() == RequestType::Id)
+                             {
+                                 send_id(client_addr, *shard.loop, shard.fd);
+                                 return;
+                             }
+                             ForwardedRequest *slot = raw.size() <= kMaxForwarded ? shard.forwarded.claim() : nullptr;
+                             if (slot == nullptr)
+                             {
+                                 LOG_WARN("Dropped a request to port %d: %s", this->port_,
+                                          raw.size() > kMaxForwarded ? "too long" : "server loop is behind");
+                                 return;
+                             }
+                             slot->client_addr = client_addr;
+                             slot->length = raw.size();
+                             std::memcpy(slot->text, raw.data(), raw.size());
+                             shard.forwarded.publish();
+                             forwarded = true;
+                         });
+        if (forwarded)
+        {
+            // captures two pointers, which std::function holds without allocating
+            this->loop_->post([this, &shard]
+                              { this->drain_forwarded(shard); });
+        }
+    }
+
+    // Handles the requests a shard has forwarded, on the server's own loop
+    void drain_forwarded(Shard &shard)
+    {
+        while (const ForwardedRequest *slot = shard.forwarded.front())
+        {
+            if (this->request_.parse(std::string_view(slot->text, slot->length)))
+            {
+                fulfill_request(this->request_, slot->client_addr);
+            }
+            shard.forwarded.release();
+        }
+    }
+
+    // Drains every pending request from a (non-blocking) server socket, a recvmmsg batch at a time,
+    // calling handle(request, raw text, client address) for each one that parses
+    template <typename Handle>
+    void receive_requests(int fd, RecvBatch &batch, Request &request, Handle handle)
+    {
+        while (true)
+        {
+            int received = batch.receive(fd);
+            if (received < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    LOG_ERROR("Error receiving data: %s", std::strerror(errno));
+                }
+                return;
+            }
+
+            for (int i = 0; i < received; i++)
+            {
+                std::string_view received_request(batch.data(i), batch.length(i));
+                LOG_TRACE("Received message: %.*s", static_cast<int>(received_request.size()), received_request.data());
+
+                if (request.parse(received_request))
+                {
+                    this->stats_.requests[static_cast<size_t>(request.type())].fetch_add(1, std::memory_order_relaxed);
+                    handle(request, received_request, batch.addr(i));
+                }
+                else
+                {
+                    this->stats_.malformed.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            if (received < RecvBatch::kCapacity)
+            {
+                return; // socket drained
+            }
+        }
+    }
+
+    // Sends an encoded frame to the client
+    void send_message(const FrameEncoder &message, const sockaddr_in &client_addr)
+    {
+        send_message(message, client_addr, *this->loop_, this->server_fd_);
+    }
+
+    // Sends an encoded frame to the client from socket fd of loop
+    void send_message(const FrameEncoder &message, const sockaddr_in &client_addr, EventLoop &loop, int fd)
+    {
+        if (!message.ok())
+        {
+            LOG_ERROR("Error sending message: frame exceeds %zu bytes", FrameEncoder::kCapacity);
+            return;
+        }
+
+        LOG_TRACE("Sending message: %.*s", static_cast<int>(message.view().size()), message.view().data());
+        loop.send(fd, client_addr, message.view().data(), message.view().size());
+    }
+
+    // Sends an encoded frame to every subscriber of the running test; tag is as EventLoop::send()'s
+    void publish(const FrameEncoder &message, uint64_t tag = EventLoop::kUntagged)
+    {
+        if (!message.ok())
+        {
+            LOG_ERROR("Error sending message: frame exceeds %zu bytes", FrameEncoder::kCapacity);
+            return;
+        }
+
+        LOG_TRACE("Sending message: %.*s", static_cast<int>(message.view().size()), message.view().data());
+        publish_frame(message.view(), tag);
+    }
+
+    // Sends a binary telemetry frame to every subscriber of the running test
+    void publish(const BinaryFrameEncoder &message, uint64_t tag = EventLoop::kUntagged)
+    {
+        LOG_TRACE("Sending binary message: seq=%u samples=%u", message.sequence(), static_cast<unsigned>(message.sample_count()));
+        publish_frame(message.view(), tag);
+    }
+
+    // Sends a binary telemetry frame to one client
+    void send_message(const BinaryFrameEncoder &message, const sockaddr_in &client_addr)
+    {
+        LOG_TRACE("Sending binary message: seq=%u samples=%u", message.sequence(), static_cast<unsigned>(message.sample_count()));
+        this->loop_->send(this->server_fd_, client_addr, message.view().data(), message.view().size());
+    }
+
+    bool multicast() const { return this->multicast_addr_.sin_family == AF_INET; }
+
+    std::string capture_path() const
+    {
+        return this->capture_dir_ + "/" + this->device_.model() + "_" + std::to_string(this->device_.serial_number()) + ".cap";
+    }
+
+    // Queues raw frame bytes once for all subscribers (or the multicast group); the loop sends every
+    // copy due this round in one sendmmsg call
+    void publish_frame(std::string_view frame, uint64_t tag)
+    {
+        if (multicast())
+        {
+            this->loop_->send(this->server_fd_, this->multicast_addr_, frame.data(), frame.size(), tag);
+            return;
+        }
+        this->loop_->send_to_all(this->server_fd_, this->test_subscribers_.data(), this->test_subscribers_.size(),
+                                 frame.data(), frame.size(), tag);
+    }
+
+    // Sends a TEST response carrying only a RESULT
+    void send_test_result(std::string_view result, const sockaddr_in &client_addr)
+    {
+        FrameEncoder frame(kTypeTest);
+        frame.add(kKeyResult, result);
+        send_message(frame, client_addr);
+    }
+
+    // Sends a TEST error response with a human-readable MSG
+    void send_test_error(std::string_view result, std::string_view msg, const sockaddr_in &client_addr)
+    {
+        FrameEncoder frame(kTypeTest);
+        frame.add(kKeyMsg, msg).add(kKeyResult, result);
+        send_message(frame, client_addr);
+    }
+
+    // Sends the ID response describing the device from socket fd of loop. It only reads what never
+    // changes once the device is serving, so any worker may call it.
+    void send_id(const sockaddr_in &client_addr, EventLoop &loop, int fd)
+    {
+        FrameEncoder frame(kTypeId);
+        frame.add(kKeyModel, this->device_.model())
+            .add(kKeySerial, this->device_.serial_number())
+            .add(kKeySignal, this->device_.signal()->name())
+            .add(kKeyChannels, static_cast<int64_t>(this->device_.channels()));
+        if (multicast())
+        {
+            frame.add(kKeyMulticast, this->multicast_name_);
+        }
+        send_message(frame, client_addr, loop, fd);
+    }
+
+    // Sends STATS: request counts by type, the current (or last) test's transmit tick jitter and frame
+    // encode time, its sample ring drops, and what the process's event loops handed to the kernel.
+    // Each timing is "count,p50,p99,p999,max" in nanoseconds.
+    void send_stats(const sockaddr_in &client_addr)
+    {
+        auto load = [](const std::atomic<uint64_t> &counter)
+        { return static_cast<int64_t>(counter.load(std::memory_order_relaxed)); };
+        auto add_histogram = [](FrameEncoder &frame, std::string_view key, const Histogram &histogram)
+        {
+            uint64_t values[5] = {histogram.count(), histogram.quantile(0.5), histogram.quantile(0.99),
+                                  histogram.quantile(0.999), histogram.max()};
+            int32_t summary[5];
+            for (size_t i = 0; i < 5; i++)
+            {
+                summary[i] = static_cast<int32_t>(values[i] < INT32_MAX ? values[i] : INT32_MAX); // saturate
+            }
+            frame.add(key, summary, 5);
+        };
+        const SendMetrics &sends = SendMetrics::instance();
+
+        FrameEncoder frame(kTypeStats);
+        frame.add(kKeyRequestsId, load(this->stats_.requests[static_cast<size_t>(RequestType::Id)]))
+            .add(kKeyRequestsTest, load(this->stats_.requests[static_cast<size_t>(RequestType::Test)]))
+            .add(kKeyRequestsStats, load(this->stats_.requests[static_cast<size_t>(RequestType::Stats)]))
+            .add(kKeyRequestsOther, load(this->stats_.requests[static_cast<size_t>(RequestType::Unknown)]) + load(this->stats_.malformed))
+            .add(kKeyFrames, static_cast<int64_t>(this->test_sequence_))
+            .add(kKeySamplesDropped, static_cast<int64_t>(this->device_.samples().dropped()));
+        add_histogram(frame, kKeyTickJitter, this->stats_.tick_jitter);
+        add_histogram(frame, kKeyEncodeTime, this->stats_.encode_time);
+        frame.add(kKeyDatagrams, load(sends.datagrams))
+            .add(kKeySendFailed, load(sends.failed))
+            .add(kKeySendPartial, load(sends.partial))
+            .add(kKeySendDropped, load(sends.dropped));
+        add_histogram(frame, kKeySendTime, sends.call_time);
+        send_message(frame, client_addr);
+    }
+
+    // Sends the STATUS frame announcing that the device is idle to every subscriber, and to
+    // client_addr if it is not one of them (unless it is published to a multicast group). It ends a
+    // test, and carries FRAMES, the number of STATUS frames the test sent, so that a client can tell
+    // how many it missed at the end.
+    void send_idle(const sockaddr_in *client_addr = nullptr)
+    {
+        FrameEncoder frame(kTypeStatus);
+        frame.add(kKeyState, kStateIdle).add(kKeyFrames, static_cast<int64_t>(this->test_sequence_));
+        publish(frame);
+        if (client_addr != nullptr && !multicast() && find_subscriber(*client_addr) == this->test_subscribers_.end())
+        {
+            send_message(frame, *client_addr);
+        }
+    }
+
+    static bool same_client(const sockaddr_in &a, const sockaddr_in &b)
+    {
+        return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+    }
+
+    std::vector<sockaddr_in>::iterator find_subscriber(const sockaddr_in &client_addr)
+    {
+        return std::find_if(this->test_subscribers_.begin(), this->test_subscribers_.end(), [&client_addr](const sockaddr_in &subscriber)
+                            { return same_client(subscriber, client_addr); });
+    }
+
+    // Fulfills a parsed request and sends an appropriate response
+    void fulfill_request(const Request &request, const sockaddr_in &client_addr)
+    {
+        switch (request.type())
+        {
+        case RequestType::Id:
+            send_id(client_addr, *this->loop_, this->server_fd_);
+            return;
+
+        case RequestType::Stats:
+            send_stats(client_addr);
+            return;
+
+        case RequestType::Test:
+            switch (request.command())
+            {
+            case TestCommand::Start:
+            {
+                if (test_running())
+                {
+                    send_test_error("ERROR1", "Attempting to start testing on a device that is already testing", client_addr);
+                    return;
+                }
+                TestOptions options;
+                if (!options.parse(request, this->device_.channels()))
+                {
+                    break; // missing or malformed RATE/DURATION/FORMAT/SIGNAL
+                }
+                start_test(options, client_addr);
+                return;
+            }
+
+            case TestCommand::Stop:
+                if (!test_running())
+                {
+                    send_test_error("ERROR2", "Attempting to stop testing on a device that is not testing", client_addr);
+                    return;
+                }
+                if (this->test_stopping_)
+                {
+                    return; // already stopping; STOPPED follows as soon as the sampler lets go
+                }
+                stop_test(client_addr);
+                return;
+
+            case TestCommand::Subscribe:
+                if (!test_running())
+                {
+                    send_test_error("ERROR2", "Attempting to subscribe to a device that is not testing", client_addr);
+                    return;
+                }
+                if (find_subscriber(client_addr) == this->test_subscribers_.end())
+                {
+                    if (this->test_subscribers_.size() == kMaxSubscribers)
+                    {
+                        send_test_error("ERROR3", "Too many subscribers", client_addr);
+                        return;
+                    }
+                    this->test_subscribers_.push_back(client_addr);
+                }
+                send_test_result("SUBSCRIBED", client_addr);
+                return;
+
+            case TestCommand::Unsubscribe:
+            {
+                if (!test_running())
+                {
+                    send_test_error("ERROR2", "Attempting to unsubscribe from a device that is not testing", client_addr);
+                    return;
+                }
+                auto subscriber = find_subscriber(client_addr);
+                if (subscriber != this->test_subscribers_.end())
+                {
+                    this->test_subscribers_.erase(subscriber);
+                }
+                send_test_result("UNSUBSCRIBED", client_addr);
+                return;
+            }
+
+            case TestCommand::Fetch:
+            {
+                int from_ms, to_ms;
+                std::string_view frame_format = kFormatText;
+                request.get(kKeyFormat, frame_format);
+                if (!request.get_int(kKeyFrom, from_ms) || !request.get_int(kKeyTo, to_ms) ||
+                    (frame_format != kFormatText && frame_format != kFormatBinary) ||
+                    (frame_format == kFormatText && SampleBatch::max_text(this->device_.channels(), false, false, CaptureFile::kMaxTimeMs) == 0))
+                {
+                    break; // missing or malformed FROM/TO/FORMAT, or too many channels for a text frame
+                }
+                if (!this->capture_.is_open())
+                {
+                    send_test_error("ERROR4", "No capture available on this device", client_addr);
+                    return;
+                }
+                fetch_capture(from_ms, to_ms, frame_format == kFormatBinary ? FrameFormat::Binary : FrameFormat::Text, client_addr);
+                return;
+            }
+
+            case TestCommand::Resend:
+            {
+                int from, to;
+                if (!request.get_int(kKeyFrom, from) || !request.get_int(kKeyTo, to) || from < 0 || to < from)
+                {
+                    break; // missing or malformed FROM/TO
+                }
+                resend_frames(static_cast<uint32_t>(from), static_cast<uint32_t>(to), client_addr);
+                return;
+            }
+
+            case TestCommand::Ack:
+            {
+                int sequence;
+                if (!request.get_int(kKeySeq, sequence) || sequence < 0)
+                {
+                    break; // missing or malformed SEQ
+                }
+                int window;
+                if (request.has(kKeyWindow) && (!request.get_int(kKeyWindow, window) || window < 0))
+                {
+                    break;
+                }
+                // only the client that started the test paces it; ACK is never answered
+                if (test_running() && this->test_starter_.sin_family == AF_INET && same_client(this->test_starter_, client_addr))
+                {
+                    acknowledge(static_cast<uint32_t>(sequence), request.has(kKeyWindow) ? window : -1);
+                }
+                return;
+            }
+
+            default:
+                break;
+            }
+            break;
+
+        default:
+            break;
+        }
+        LOG_WARN("Invalid request received");
+    }
+
+    // Starts a test: the sampler takes a reading every rate into the device's sample ring, and this
+    // server drains the ring into STATUS frames on its own transmit schedule
+    void start_test(const TestOptions &options, const sockaddr_in &client_addr)
+    {
+        std::chrono::milliseconds rate = options.rate;
+        if (rate.count() <= 0)
+        {
+            rate = std::chrono::milliseconds{1}; // the timer wheel resolution
+        }
+
+        // a test that cannot be captured is refused rather than run without its capture
+        if (!this->capture_dir_.empty())
+        {
+            int64_t samples = std::chrono::duration_cast<std::chrono::milliseconds>(options.duration).count() / rate.count() + 1;
+            if (!this->capture_.create(capture_path(), this->device_, rate, samples < 1 ? 1 : static_cast<size_t>(samples)))
+            {
+                send_test_error("ERROR5", "Could not create the capture file", client_addr);
+                return;
+            }
+        }
+
+        this->device_.set_is_idle(false);
+        this->test_running_ = true;
+        this->test_subscribers_.assign(1, client_addr);
+        this->test_starter_ = client_addr;
+        this->test_tick_ = 0;
+        this->test_format_ = options.format;
+        this->test_sequence_ = 0;
+        this->sent_frames_.clear();
+        this->stats_.tick_jitter.clear();
+        this->stats_.encode_time.clear();
+        this->test_batch_ = options.batch;
+        this->test_max_latency_ = options.max_latency;
+        this->aggregator_.reset(options.aggregate);
+        this->pending_ = options.aggregate > 0 ? &this->summaries_ : &this->readings_;
+        this->test_step_ms_ = rate.count() * static_cast<int64_t>(options.aggregate > 0 ? options.aggregate : 1);
+        this->test_clock_ = FrameClock();
+        this->test_clock_.unit = options.clock;
+        bool stamped = this->test_clock_.enabled();
+        size_t columns = this->pending_->channels;
+        this->test_frame_limit_ = options.format == FrameFormat::Binary ? SampleBatch::max_binary(columns, stamped)
+                                                                         : SampleBatch::max_text(columns, stamped, this->pending_->summaries, options.max_time_ms());
+        if (stamped != this->tx_stamps_enabled_)
+        {
+            set_tx_stamps(stamped);
+        }
+        this->test_window_ = options.window;
+        this->test_acked_ = 0;
+        this->test_decimation_ = 1;
+        this->test_last_flush_ = std::chrono::steady_clock::now();
+        this->pending_->allocate();
+        this->pending_->clear();
+        this->device_.samples().allocate();
+        this->test_generation_++;
+        this->test_start_time_ = std::chrono::steady_clock::now();
+
+        // drain once per expected batch (or more often to honour LATENCY), shortly after the
+        // readings are due so a batch is normally complete when it is picked up
+        this->test_transmit_period_ = std::chrono::milliseconds{this->test_step_ms_} * static_cast<int64_t>(options.batch);
+        if (options.max_latency.count() > 0 && options.max_latency < this->test_transmit_period_)
+        {
+            this->test_transmit_period_ = options.max_latency < rate ? rate : options.max_latency;
+        }
+        this->test_transmit_lag_ = std::min(rate / 2, std::chrono::milliseconds{10});
+        if (this->test_transmit_lag_.count() < 1)
+        {
+            this->test_transmit_lag_ = std::chrono::milliseconds{1};
+        }
+
+        send_test_result("STARTED", client_addr);
+
+        this->sampler_->start(this->sampling_job_, options.signal != nullptr ? options.signal : this->device_.signal(), rate, options.duration, this->test_start_time_, this->test_generation_);
+        this->loop_->schedule(this->test_timer_, this->test_start_time_ + this->test_transmit_lag_);
+    }
+
+    // Handles a transmit tick: drains the device's sample ring into STATUS frames, or ends the test
+    // once the sampler reports that the duration has elapsed
+    void on_transmit_tick()
+    {
+        auto offset = this->test_tick_ * this->test_transmit_period_;
+        this->stats_.tick_jitter.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                            std::chrono::steady_clock::now() - (this->test_start_time_ + offset + this->test_transmit_lag_))
+                                            .count());
+        if (drain_samples())
+        {
+            stop_timer();
+            this->device_.set_is_idle(true);
+            flush_window(true);
+            flush_samples();
+            this->capture_.finish();
+            this->test_starter_ = sockaddr_in{};
+            send_idle();
+            return;
+        }
+
+        if (!this->pending_->empty() && this->test_max_latency_.count() > 0 &&
+            offset.count() - this->pending_->time_ms[0] >= this->test_max_latency_.count() && window_open())
+        {
+            flush_samples();
+        }
+        else if (!this->pending_->empty() && !window_open() &&
+                 std::chrono::steady_clock::now() - this->test_last_flush_ >= kPacingProbe)
+        {
+            // the frames in flight may all have been lost, leaving the client nothing to ACK
+            flush_samples();
+        }
+
+        this->test_tick_++;
+        this->loop_->schedule(this->test_timer_, this->test_start_time_ + this->test_tick_ * this->test_transmit_period_ + this->test_transmit_lag_);
+    }
+
+    // Moves this test's readings from the sample ring into the pending batch, sending every batch
+    // that fills up. Returns true once the end-of-test marker has been reached.
+    bool drain_samples()
+    {
+        SampleQueue &queue = this->device_.samples();
+        while (const Sample *sample = queue.front())
+        {
+            if (sample->generation != this->test_generation_)
+            {
+                queue.release(); // left over from an earlier test
+                continue;
+            }
+            if (sample->last)
+            {
+                queue.release();
+                return true;
+            }
+            this->capture_.record(sample->time_ms, queue.millivolts(sample), queue.milliamps(sample));
+            int64_t timestamp = this->test_clock_.convert(sample->taken_ns);
+            if (this->aggregator_.active())
+            {
+                if (this->aggregator_.add(sample->time_ms, timestamp, queue.millivolts(sample), queue.milliamps(sample)))
+                {
+                    flush_window(false);
+                }
+            }
+            else if ((sample->time_ms / this->test_step_ms_) % this->test_decimation_ == 0)
+            {
+                this->pending_->push(sample->time_ms, queue.millivolts(sample), queue.milliamps(sample), timestamp);
+            }
+            queue.release();
+            if (this->pending_->count >= this->test_batch_)
+            {
+                send_or_hold();
+            }
+        }
+        return false;
+    }
+
+    // Adds the AGG window summarised so far to the pending batch, unless pacing thins it out; a final
+    // window (the test is over) always goes out, however few readings it has
+    void flush_window(bool final)
+    {
+        if (this->aggregator_.empty())
+        {
+            return;
+        }
+        if (final || (this->aggregator_.start_ms() / this->test_step_ms_) % this->test_decimation_ == 0)
+        {
+            if (this->pending_->count >= this->test_frame_limit_)
+            {
+                flush_samples(); // held back by pacing and already a full frame
+            }
+            this->aggregator_.flush(*this->pending_);
+        }
+        else
+        {
+            this->aggregator_.discard();
+        }
+    }
+
+    // Sends the full pending batch if the client's window allows it. Otherwise the batch is held and
+    // grows up to a whole frame, and once that is full the test's readings are thinned: only every
+    // other reading of the current stride is kept from then on. At kMaxDecimation the frame goes out
+    // regardless, so a client whose ACKs stopped still sees the test progress.
+    void send_or_hold()
+    {
+        if (window_open() || this->test_decimation_ >= kMaxDecimation)
+        {
+            flush_samples();
+            return;
+        }
+        if (this->pending_->count >= this->test_frame_limit_)
+        {
+            this->test_decimation_ *= 2;
+            this->pending_->keep_multiples(this->test_step_ms_ * this->test_decimation_);
+            LOG_INFO("Client window full: sending every %lld readings", static_cast<long long>(this->test_decimation_));
+        }
+    }
+
+    // True if the client's window has room for another STATUS frame (always, without WINDOW)
+    bool window_open() const
+    {
+        return this->test_window_ == 0 || this->test_sequence_ - this->test_acked_ < this->test_window_;
+    }
+
+    // Handles the starter's ACK of every STATUS frame up to sequence, optionally resizing its window
+    // (window < 0 keeps it). Thinning is undone one step at a time while the window is at most half used.
+    void acknowledge(uint32_t sequence, int window)
+    {
+        if (window >= 0)
+        {
+            this->test_window_ = static_cast<size_t>(window);
+        }
+        if (sequence < this->test_sequence_ && sequence + 1 > this->test_acked_)
+        {
+            this->test_acked_ = sequence + 1;
+        }
+        if (this->test_decimation_ > 1 &&
+            (this->test_window_ == 0 || 2 * (this->test_sequence_ - this->test_acked_) <= this->test_window_))
+        {
+            this->test_decimation_ /= 2;
+            LOG_INFO("Client window recovered: sending every %lld readings", static_cast<long long>(this->test_decimation_));
+        }
+        if (this->pending_->count >= this->test_batch_ && window_open())
+        {
+            flush_samples();
+        }
+    }
+
+    // Sends every pending sample as one STATUS frame in the test's format
+    void flush_samples()
+    {
+        if (this->pending_->empty())
+        {
+            return;
+        }
+        // a frame that does not fit is neither sent nor kept for RESEND, and takes no sequence number
+        uint32_t sequence = this->test_sequence_;
+        auto started = std::chrono::steady_clock::now();
+        encode_batch(*this->pending_, this->test_format_, sequence, 0, this->test_clock_, [this, sequence, started](const auto &frame)
+                     {
+                         this->stats_.encode_time.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());
+                         if (!frame.ok())
+                         {
+                             LOG_ERROR("Dropped STATUS frame %u on port %d: %zu samples do not fit in one frame",
+                                       sequence, this->port_, this->pending_->count);
+                             return;
+                         }
+                         this->publish(frame, transmit_tag(sequence));
+                         this->sent_frames_.store(sequence, frame.view());
+                         this->test_sequence_++;
+                     });
+        this->test_clock_.has_transmitted = false;
+        this->pending_->clear();
+        this->test_last_flush_ = std::chrono::steady_clock::now();
+    }
+
+    // Turns the kernel's transmit timestamps of the server socket's datagrams on or off
+    void set_tx_stamps(bool enabled)
+    {
+        if (!enabled)
+        {
+            this->loop_->disable_tx_timestamps(this->server_fd_);
+            this->tx_stamps_enabled_ = false;
+            return;
+        }
+        this->tx_stamps_enabled_ = this->loop_->enable_tx_timestamps(this->server_fd_, [this](uint64_t tag, int64_t sent_ns)
+                                                                     { this->on_frame_sent(tag, sent_ns); });
+    }
+
+    // The transmit timestamp tag of STATUS frame sequence of the current test: the test generation
+    // above the sequence, since every test numbers its frames from 0 again
+    uint64_t transmit_tag(uint32_t sequence) const
+    {
+        return static_cast<uint64_t>(this->test_generation_) << 32 | sequence;
+    }
+
+    // Notes when the kernel sent the STATUS frame tagged tag, for the next frame's TX. Of the copies
+    // sent to several subscribers, the first (the starter's) counts. Stamps of an earlier test's
+    // frames, which may still be arriving after a new test has started, are ignored.
+    void on_frame_sent(uint64_t tag, int64_t sent_ns)
+    {
+        FrameClock &clock = this->test_clock_;
+        uint32_t sequence = static_cast<uint32_t>(tag);
+        if (!clock.enabled() || !test_running() || tag >> 32 != this->test_generation_ ||
+            sequence < clock.next_stamped || sequence >= this->test_sequence_)
+        {
+            return;
+        }
+        clock.has_transmitted = true;
+        clock.transmitted_sequence = sequence;
+        clock.transmitted_time = clock.convert(sent_ns);
+        clock.next_stamped = sequence + 1;
+    }
+
+    // Encodes batch as one STATUS frame in format and hands it to emit. Every frame carries sequence
+    // (SEQ in text frames); text frames carry REPLAY=1 when flags has BinaryFrameEncoder::kFlagReplay.
+    // With clock enabled, the frame also carries the batch's TS and clock's TX, if it has one.
+    template <typename Emit>
+    static void encode_batch(const SampleBatch &batch, FrameFormat format, uint32_t sequence, uint8_t flags,
+                             const FrameClock &clock, Emit emit)
+    {
+        if (format == FrameFormat::Binary)
+        {
+            flags |= clock.enabled() ? BinaryFrameEncoder::kFlagTimestamps : 0;
+            flags |= clock.has_transmitted ? BinaryFrameEncoder::kFlagTransmitted : 0;
+            uint8_t kind = batch.summaries ? BinaryFrameEncoder::kKindSummary : batch.channels > 1 ? BinaryFrameEncoder::kKindChannels : BinaryFrameEncoder::kKindStatus;
+            BinaryFrameEncoder frame(kind, sequence, flags);
+            if (batch.channels > 1)
+            {
+                frame.add_channel_block(batch.time_ms.data(), batch.millivolts.data(), batch.milliamps.data(),
+                                        batch.count, batch.channels, batch.capacity);
+            }
+            else
+            {
+                for (size_t i = 0; i < batch.count; i++)
+                {
+                    frame.add_sample(static_cast<uint32_t>(batch.time_ms[i]),
+                                     static_cast<int16_t>(batch.millivolts[i]),
+                                     static_cast<int16_t>(batch.milliamps[i]));
+                }
+            }
+            if (clock.enabled())
+            {
+                frame.add_timestamps(batch.timestamps.data(), batch.count);
+            }
+            if (clock.has_transmitted)
+            {
+                frame.add_transmitted(clock.transmitted_sequence, clock.transmitted_time);
+            }
+            emit(frame);
+            return;
+        }
+
+        FrameEncoder frame(kTypeStatus);
+        if (batch.channels == 1)
+        {
+            frame.add(kKeyMa, batch.milliamps.data(), batch.count).add(kKeyMv, batch.millivolts.data(), batch.count);
+        }
+        else
+        {
+            // one MA<c> and MV<c> list per channel, or in a summary one for each statistic: MA_MIN,
+            // MA_MAX, MA (the mean) and MA_RMS, and likewise for MV (numbered only with several channels)
+            size_t stats = batch.summaries ? SampleBatch::kSummaryStats : 1;
+            size_t channels = batch.channels / stats;
+            for (size_t channel = 0; channel < channels; channel++)
+            {
+                for (size_t stat = 0; stat < stats; stat++)
+                {
+                    char key[16];
+                    const size_t *number = channels > 1 ? &channel : nullptr;
+                    std::string_view suffix = batch.summaries ? kStatSuffixes[stat] : "";
+                    frame.add(column_key(key, kKeyMa, number, suffix), batch.milliamps_column(channel * stats + stat), batch.count);
+                }
+                for (size_t stat = 0; stat < stats; stat++)
+                {
+                    char key[16];
+                    const size_t *number = channels > 1 ? &channel : nullptr;
+                    std::string_view suffix = batch.summaries ? kStatSuffixes[stat] : "";
+                    frame.add(column_key(key, kKeyMv, number, suffix), batch.millivolts_column(channel * stats + stat), batch.count);
+                }
+            }
+        }
+        frame.add_seconds(kKeyTime, batch.time_ms.data(), batch.count);
+        if (clock.enabled())
+        {
+            frame.add(kKeyTimestamps, batch.timestamps.data(), batch.count);
+        }
+        frame.add(kKeySeq, static_cast<int64_t>(sequence));
+        if (clock.has_transmitted)
+        {
+            int64_t transmitted[2] = {clock.transmitted_sequence, clock.transmitted_time};
+            frame.add(kKeyTransmitted, transmitted, 2);
+        }
+        if (flags & BinaryFrameEncoder::kFlagReplay)
+        {
+            frame.add(kKeyReplay, int64_t{1});
+        }
+        emit(frame);
+    }
+
+    // Sends the kept STATUS frames with sequence numbers from to to (inclusive) to client_addr again,
+    // then TEST;RESULT=RESENT with how many were sent. Frames too old to be kept are skipped, and
+    // FIRST then tells the client the oldest sequence number it can still ask for.
+    void resend_frames(uint32_t from, uint32_t to, const sockaddr_in &client_addr)
+    {
+        const RetransmitRing &ring = this->sent_frames_;
+        uint32_t first = from > ring.begin() ? from : ring.begin();
+        uint32_t end = to < ring.end() ? to + 1 : ring.end();
+        int64_t count = 0;
+        for (uint32_t sequence = first; sequence < end; sequence++)
+        {
+            std::string_view frame = ring.frame(sequence);
+            this->loop_->send(this->server_fd_, client_addr, frame.data(), frame.size());
+            count++;
+        }
+        LOG_INFO("Resent %lld frames", static_cast<long long>(count));
 
-// Device class represents a simulated device with a model, serial number, and idle state.
-class Device
-{
-public:
-    // Constructor: initializes the device with the given model and serial number
-    Device(std::string model, int serial_number)
-        : model_(model), serial_number_(serial_number) {}
+        FrameEncoder frame(kTypeTest);
+        frame.add(kKeyCount, count);
+        if (from < ring.begin())
+        {
+            frame.add(kKeyFirst, static_cast<int64_t>(ring.begin()));
+        }
+        frame.add(kKeyResult, "RESENT");
+        send_message(frame, client_addr);
+    }
 
-    // Member variables
-    std::string model_;
-    int serial_number_;
-    bool is_idle_ = true;
+    // Sends the captured readings due between from_ms and to_ms (inclusive) to client_addr as STATUS
+    // frames in format, then TEST;RESULT=FETCHED with the number of samples sent. At most kMaxFetchFrames
+    // frames go out per request; when the range goes on, FETCHED carries NEXT, the time to resume from.
+    void fetch_capture(int64_t from_ms, int64_t to_ms, FrameFormat format, const sockaddr_in &client_addr)
+    {
+        const CaptureFile &capture = this->capture_;
+        int64_t rate = capture.rate().count();
+        size_t index = from_ms <= 0 ? 0 : static_cast<size_t>((from_ms + rate - 1) / rate);
+        size_t end = to_ms < 0 ? 0 : static_cast<size_t>(to_ms / rate) + 1;
+        end = end < capture.count() ? end : capture.count();
 
-    // Accessor functions
-    std::string model() const { return model_; }
-    int serial_number() const { return serial_number_; }
-    bool is_idle() const { return is_idle_; }
+        size_t per_frame = format == FrameFormat::Binary ? SampleBatch::max_binary(this->device_.channels())
+                                                         : SampleBatch::max_text(this->device_.channels(), false, false, CaptureFile::kMaxTimeMs);
+        SampleBatch &batch = this->fetched_;
+        batch.allocate();
+        size_t frames = 0;
+        int64_t sent = 0;
+        for (; index < end && frames < kMaxFetchFrames; index++)
+        {
+            if (capture.read(index, batch) && batch.count == per_frame)
+            {
+                sent += static_cast<int64_t>(batch.count);
+                encode_batch(batch, format, static_cast<uint32_t>(frames++), BinaryFrameEncoder::kFlagReplay, FrameClock(),
+                             [this, &client_addr](const auto &frame)
+                             { this->send_message(frame, client_addr); });
+                batch.clear();
+            }
+        }
+        if (!batch.empty())
+        {
+            sent += static_cast<int64_t>(batch.count);
+            encode_batch(batch, format, static_cast<uint32_t>(frames++), BinaryFrameEncoder::kFlagReplay, FrameClock(),
+                         [this, &client_addr](const auto &frame)
+                         { this->send_message(frame, client_addr); });
+            batch.clear();
+        }
 
-    // Mutator functions
-    void set_is_idle(bool state) { this->is_idle_ = state; }
+        FrameEncoder frame(kTypeTest);
+        frame.add(kKeyCount, sent);
+        if (index < end)
+        {
+            frame.add(kKeyNext, static_cast<int64_t>(index) * rate);
+        }
+        frame.add(kKeyResult, "FETCHED");
+        send_message(frame, client_addr);
+    }
+
+    // Writes the text key of a quantity, numbered with its channel if given and followed by suffix,
+    // into buffer ("MV", "MA12", "MV3_RMS", ...)
+    static std::string_view column_key(char (&buffer)[16], std::string_view quantity, const size_t *channel, std::string_view suffix)
+    {
+        std::memcpy(buffer, quantity.data(), quantity.size());
+        char *end = buffer + quantity.size();
+        if (channel != nullptr)
+        {
+            end = std::to_chars(end, buffer + sizeof(buffer), *channel).ptr;
+        }
+        std::memcpy(end, suffix.data(), suffix.size());
+        end += suffix.size();
+        return std::string_view(buffer, static_cast<size_t>(end - buffer));
+    }
 
-    // Simulated functions for millivolts and milliamps readings
-    int get_millivolts()
+    // Stops the running test without blocking the loop: the sampler is told to stop, and once it
+    // confirms (through this loop's eventfd) the remaining readings are sent, then STOPPED and IDLE.
+    // Both callbacks capture at most two pointers, which std::function holds without allocating.
+    void stop_test(const sockaddr_in &client_addr)
     {
-        // simulate by returning a random value between 1800 and 5000
-        return rand() % 3200 + 1800;
+        this->device_.set_is_idle(true);
+        stop_timer();
+        this->test_stopping_ = true;
+        this->stop_client_ = client_addr;
+        EventLoop *loop = this->loop_;
+        this->sampler_->stop(this->sampling_job_, [this, loop]
+                             { loop->post([this]
+                                          { this->finish_stop(); }); });
     }
 
-    int get_milliamps()
+    void finish_stop()
     {
-        // simulate by returning a return a random value between 0 and 100
-        return rand() % 100;
+        const sockaddr_in &client_addr = this->stop_client_;
+        if (!this->test_stopping_)
+        {
+            return; // the server was detached in the meantime
+        }
+        this->test_stopping_ = false;
+        drain_samples();
+        flush_window(true);
+        flush_samples();
+        this->capture_.finish();
+        this->test_generation_++;
+        this->test_starter_ = sockaddr_in{};
+        send_test_result("STOPPED", client_addr);
+        send_idle(&client_addr);
+    }
+
+    // Cancels the pending STATUS tick, if any, and marks the test as over
+    void stop_timer()
+    {
+        this->test_running_ = false;
+        if (this->loop_ != nullptr)
+        {
+            this->loop_->cancel(this->test_timer_);
+        }
     }
 };
 
-// DeviceServer class represents a UDP server that communicates with clients to control and monitor the Device
-class DeviceServer
+// DiscoveryResponder listens on the shared discovery port for the ID requests a fleet scan broadcasts
+// (or sends to a multicast group) and asks every server of its process to answer from its own socket,
+// so the scanner learns each device's address and port from the reply. Servers on other loops than
+// the responder's are asked through a post to their loop. There is one responder per process: the
+// socket is bound with SO_REUSEADDR, which gives every device process on a host its own copy of each
+// broadcast or multicast scan, but hands a unicast scan to only one of them.
+class DiscoveryResponder
 {
 public:
-    // Constructor: initializes the server with the given port number and a reference to a device
-    DeviceServer(int port, Device &device)
-        : port_(port), device_(device)
+    static constexpr std::chrono::milliseconds kDefaultJitter{100};
+    static constexpr std::chrono::milliseconds kMaxJitter{1000};
+
+    // Constructor: endpoint holds the discovery port, and the multicast group to join (if any) as its address
+    explicit DiscoveryResponder(const sockaddr_in &endpoint) : endpoint_(endpoint) {}
+
+    ~DiscoveryResponder()
     {
-        this->server_addr_.sin_family = AF_INET;
-        this->server_addr_.sin_addr.s_addr = htonl(INADDR_ANY);
-        this->server_addr_.sin_port = htons(port);
+        if (this->fd_ >= 0)
+        {
+            if (this->loop_ != nullptr)
+            {
+                this->loop_->remove(this->fd_);
+            }
+            close(this->fd_);
+        }
     }
 
-    // Starts the server and listens for incoming requests
-    void start()
+    DiscoveryResponder(const DiscoveryResponder &) = delete;
+    DiscoveryResponder &operator=(const DiscoveryResponder &) = delete;
+
+    // Binds the discovery socket and registers it with loop
+    bool open(EventLoop &loop)
     {
-        this->server_fd_ = socket(AF_INET, SOCK_DGRAM, 0);
-        if (server_fd_ < 0 || bind(server_fd_, (sockaddr *)&server_addr_, sizeof(server_addr_)) < 0)
+        sockaddr_in bind_addr = this->endpoint_;
+        bind_addr.sin_addr.s_addr = htonl(INADDR_ANY); // broadcasts and group datagrams alike
+        int enable = 1;
+        this->fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (this->fd_ < 0 || setsockopt(this->fd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0 ||
+            bind(this->fd_, (sockaddr *)&bind_addr, sizeof(bind_addr)) < 0)
         {
-            perror("Error initializing server");
-            close(server_fd_);
-            return;
+            LOG_ERROR("Error initializing discovery: %s", std::strerror(errno));
+            return false;
         }
-        else
+        if (IN_MULTICAST(ntohl(this->endpoint_.sin_addr.s_addr)))
+        {
+            ip_mreq membership{};
+            membership.imr_multiaddr = this->endpoint_.sin_addr;
+            membership.imr_interface.s_addr = htonl(INADDR_ANY);
+            if (setsockopt(this->fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+            {
+                LOG_ERROR("Error joining discovery group: %s", std::strerror(errno));
+                return false;
+            }
+        }
+        if (!loop.add(this->fd_, [this]
+                      { this->listen(); }))
+        {
+            return false;
+        }
+        this->loop_ = &loop;
+        return true;
+    }
+
+    // Makes server, opened on loop, answer scans; servers may be added only before open()
+    void add(DeviceServer &server, EventLoop &loop)
+    {
+        for (LoopServers &group : this->groups_)
         {
-            std::cout << "Server running and listening on port " << this->port_ << std::endl;
-            listen();
+            if (group.loop == &loop)
+            {
+                group.servers.push_back(&server);
+                return;
+            }
         }
-        close(this->server_fd_);
+        this->groups_.push_back(LoopServers{&loop, {&server}});
     }
 
 private:
+    // LoopServers lists the servers that run on one event loop
+    struct LoopServers
+    {
+        EventLoop *loop;
+        std::vector<DeviceServer *> servers;
+    };
+
     // Member variables
-    int port_;
-    Device &device_;
-    sockaddr_in server_addr_;
-    int server_fd_;
-    std::atomic<bool> test_running_{false};
+    sockaddr_in endpoint_;
+    int fd_ = -1;
+    EventLoop *loop_ = nullptr;
+    std::vector<LoopServers> groups_;
+    Request request_; // reused for every received scan
 
-    // Continuously listens for incoming requests
+    // Asks every open server of group to answer a scan from client_addr; runs on the group's loop
+    static void answer(const LoopServers &group, const sockaddr_in &client_addr, std::chrono::milliseconds window)
+    {
+        for (DeviceServer *server : group.servers)
+        {
+            if (server->is_open())
+            {
+                server->answer_discovery(client_addr, window);
+            }
+        }
+    }
+
+    // Answers every ID request waiting on the socket; JITTER=<ms> sets the reply window
     void listen()
     {
+        RecvBatch &batch = this->loop_->recv_batch();
         while (true)
         {
-            char buffer[1024];
-            sockaddr_in client_addr;
-            socklen_t client_addr_len = sizeof(client_addr);
-
-            ssize_t received_bytes = recvfrom(server_fd_, buffer, sizeof(buffer), 0, (sockaddr *)&client_addr, &client_addr_len);
-            if (received_bytes < 0)
+            int received = batch.receive(this->fd_);
+            if (received < 0)
             {
-                perror("Error receiving data");
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    LOG_ERROR("Error receiving discovery request: %s", std::strerror(errno));
+                }
                 return;
             }
 
-            std::string received_request(buffer, received_bytes);
-            std::cout << "Received message: " << received_request << std::endl;
+            for (int i = 0; i < received; i++)
+            {
+                if (!this->request_.parse(std::string_view(batch.data(i), batch.length(i))) ||
+                    this->request_.type() != RequestType::Id)
+                {
+                    continue;
+                }
+                std::chrono::milliseconds window = kDefaultJitter;
+                int jitter_ms;
+                if (this->request_.get_int(kKeyJitter, jitter_ms))
+                {
+                    window = std::chrono::milliseconds{jitter_ms < 0 ? 0 : jitter_ms};
+                    window = window > kMaxJitter ? kMaxJitter : window;
+                }
+                for (const LoopServers &group : this->groups_)
+                {
+                    if (group.loop == this->loop_)
+                    {
+                        answer(group, batch.addr(i), window);
+                        continue;
+                    }
+                    sockaddr_in client_addr = batch.addr(i);
+                    group.loop->post([&group, client_addr, window]
+                                     { answer(group, client_addr, window); });
+                }
+            }
 
-            std::map<std::string, std::string> request = parse_request(received_request);
-            if (request.size() != 0)
+            if (received < RecvBatch::kCapacity)
             {
-                fulfill_request(request, client_addr);
+                return; // socket drained
             }
         }
     }
+};
+
+void DeviceServer::start(size_t workers, const sockaddr_in *discovery)
+{
+    WorkerPool pool(workers);
+    bool opened = bind_sockets(workers - 1) && attach(pool.loop(0), pool.sampler(0));
+    for (size_t i = 1; opened && i < workers; i++)
+    {
+        opened = attach_shard(i - 1, pool.loop(i));
+    }
+    std::unique_ptr<DiscoveryResponder> responder;
+    if (opened && discovery != nullptr)
+    {
+        responder.reset(new DiscoveryResponder(*discovery));
+        responder->add(*this, pool.loop(0));
+        opened = responder->open(pool.loop(0));
+    }
+    if (opened)
+    {
+        pool.run();
+    }
+    responder.reset();
+    detach_loop();
+    pool.stop_samplers();
+}
+
+// FleetDevice describes one device of a DeviceHost: its port, identity and readings
+struct FleetDevice
+{
+    int port;
+    std::string model;
+    int serial;
+    size_t channels;
+    std::shared_ptr<const SignalModel> signal;
+};
+
+// DeviceHost class hosts a fleet of simulated devices inside a single process: the devices of a
+// --fleet file, or with --host, device i with serial (first_serial + i) on port (base_port + i).
+class DeviceHost
+{
+public:
+    // Constructor: builds the fleet's devices along with their servers, to be served from workers event
+    // loops. With a multicast group, the i-th device publishes to its port + i. Each worker builds the
+    // devices whose tests it will run, all workers at once (see run()).
+    DeviceHost(const std::vector<FleetDevice> &fleet, size_t workers, const sockaddr_in *multicast,
+               const sockaddr_in *discovery, const std::string &capture_dir)
+        : pool_(workers), created_(std::chrono::steady_clock::now())
+    {
+        if (discovery != nullptr)
+        {
+            responder_.reset(new DiscoveryResponder(*discovery)); // answers for every device of the host
+        }
+        devices_.resize(fleet.size());
+        servers_.resize(fleet.size());
+        pool_.run_on_each([&](size_t home)
+                          {
+                              for (size_t i = home; i < fleet.size(); i += workers)
+                              {
+                                  const FleetDevice &entry = fleet[i];
+                                  devices_[i].reset(new Device(entry.model, entry.serial, entry.channels));
+                                  devices_[i]->set_signal(entry.signal);
+                                  servers_[i].reset(new DeviceServer(entry.port, *devices_[i]));
+                                  servers_[i]->set_capture_dir(capture_dir);
+                                  if (multicast != nullptr)
+                                  {
+                                      sockaddr_in group = *multicast;
+                                      group.sin_port = htons(static_cast<uint16_t>(ntohs(multicast->sin_port) + i));
+                                      servers_[i]->set_multicast(group);
+                                  }
+                              } });
+    }
 
-    // Sends a response message to the client
-    void send_message(const std::map<std::string, std::string> &message, const sockaddr_in &client_addr)
+    ~DeviceHost()
     {
-        std::string frmt_msg;
+        pool_.stop_samplers(); // nothing may sample a device while it is being torn down
+    }
 
-        for (const auto &kv : message)
+    // Opens every server and serves them all. Each device's tests run on one worker, taken in turn,
+    // whose sampler takes its readings; with several workers every port also gets a socket on each
+    // of the others. Every worker binds the sockets of its own devices, all workers at once; only
+    // registering them with the loops is left to this thread.
+    void run()
+    {
+        size_t workers = pool_.size();
+        std::vector<char> bound(servers_.size());
+        pool_.run_on_each([&](size_t home)
+                          {
+                              for (size_t i = home; i < servers_.size(); i += workers)
+                              {
+                                  bound[i] = servers_[i]->bind_sockets(workers - 1);
+                              } });
+        size_t opened = 0;
+        for (size_t i = 0; i < servers_.size(); i++)
         {
-            if (kv.first == "TYPE")
+            size_t home = i % workers;
+            if (!bound[i] || !servers_[i]->attach(pool_.loop(home), pool_.sampler(home)))
+            {
+                continue;
+            }
+            opened++;
+            if (responder_)
             {
-                frmt_msg.insert(0, kv.second + ";");
+                responder_->add(*servers_[i], pool_.loop(home));
             }
-            else
+            for (size_t k = 1; k < workers; k++)
             {
-                frmt_msg += kv.first + "=" + kv.second + ";";
+                servers_[i]->attach_shard(k - 1, pool_.loop((home + k) % workers));
             }
         }
-
-        std::cout << "Sending message: " << frmt_msg << std::endl;
-
-        ssize_t sent_bytes = sendto(server_fd_, to_iso_8859_1(frmt_msg).c_str(), frmt_msg.length(), 0, (const sockaddr *)&client_addr, sizeof(client_addr));
-        if (sent_bytes < 0)
+        if (responder_)
         {
-            perror("Error sending message");
-            return;
+            responder_->open(pool_.loop(0));
         }
-        else if (static_cast<size_t>(sent_bytes) != frmt_msg.length())
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - created_);
+        LOG_INFO("Serving %zu of %zu devices on %zu workers, up in %.1f ms", opened, servers_.size(), workers,
+                 static_cast<double>(elapsed.count()) / 1000.0);
+        pool_.run();
+    }
+
+private:
+    // Member variables
+    WorkerPool pool_;
+    std::chrono::steady_clock::time_point created_;
+    std::vector<std::unique_ptr<Device>> devices_;
+    std::vector<std::unique_ptr<DeviceServer>> servers_;
+    std::unique_ptr<DiscoveryResponder> responder_; // declared last: stop answering first
+};
+
+// Prints the command-line usage
+void print_usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " <port>";
+    std::cerr << " OR: " << program << " <port> <model> <serial>";
+    std::cerr << " OR: " << program << " --host <base_port> <model> <first_serial> <count>";
+    std::cerr << " OR: " << program << " --fleet <file>" << std::endl;
+    std::cerr << "Fleet file: one device per line, port,model,serial[,channels[,signal]]; # starts a comment" << std::endl;
+    std::cerr << "Options: --channels <1-" << Device::kMaxChannels << "> (default for every device)" << std::endl;
+    std::cerr << "         --workers <1-" << WorkerPool::kMaxWorkers << "> (threads sharing each port through SO_REUSEPORT)" << std::endl;
+    std::cerr << "         --multicast <group>:<port> (publish STATUS frames to an IPv4 multicast group)" << std::endl;
+    std::cerr << "         --discovery <port> | <group>:<port> (answer broadcast or multicast ID scans)" << std::endl;
+    std::cerr << "         --capture <dir> (record every test to <dir>/<model>_<serial>.cap)" << std::endl;
+    std::cerr << "         --log-level TRACE | INFO | WARN | ERROR (default TRACE: every packet)" << std::endl;
+    std::cerr << "         --trace-rate <lines/s> (most packet trace lines per second, 0 = no limit; default 1000)" << std::endl;
+    std::cerr << "         --signal NOISE | SINE[:period_ms] | RAMP[:period_ms] | BATTERY[:discharge_ms]"
+              << " | STEP[:period_ms,fault_ms] | CSV:<path>" << std::endl;
+}
+
+// Parses the whole of text as a decimal integer within [min, max] into value; returns false otherwise
+bool parse_int(std::string_view text, int min, int max, int &value)
+{
+    int parsed = 0;
+    std::from_chars_result result = std::from_chars(text.data(), text.data() + text.size(), parsed);
+    if (text.empty() || result.ec != std::errc() || result.ptr != text.data() + text.size() || parsed < min || parsed > max)
+    {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Parses a --log-level name into level; returns false if it names no level
+bool parse_log_level(const std::string &name, LogLevel &level)
+{
+    static const std::pair<const char *, LogLevel> kLevels[] = {
+        {"TRACE", LogLevel::Trace}, {"INFO", LogLevel::Info}, {"WARN", LogLevel::Warn}, {"ERROR", LogLevel::Error}};
+    for (const auto &entry : kLevels)
+    {
+        if (name == entry.first)
         {
-            std::cerr << "Warning: Partial message sent." << std::endl;
+            level = entry.second;
+            return true;
         }
     }
+    return false;
+}
 
-    // Parses a received request into a key-value map
-    std::map<std::string, std::string> parse_request(const std::string &message)
+// Parses "<group>:<port>" into group; returns false unless it names an IPv4 multicast address and a port
+bool parse_multicast(const std::string &spec, sockaddr_in &group)
+{
+    size_t colon = spec.rfind(':');
+    if (colon == std::string::npos)
     {
-        std::map<std::string, std::string> data;
-        std::stringstream ss(message);
-        std::string segment;
-        bool first_segment = true;
+        return false;
+    }
+    int port = 0;
+    std::from_chars_result result = std::from_chars(spec.data() + colon + 1, spec.data() + spec.size(), port);
+    group.sin_family = AF_INET;
+    if (result.ec != std::errc() || result.ptr != spec.data() + spec.size() || port <= 0 || port > 65535 ||
+        inet_pton(AF_INET, spec.substr(0, colon).c_str(), &group.sin_addr) != 1 || !IN_MULTICAST(ntohl(group.sin_addr.s_addr)))
+    {
+        return false;
+    }
+    group.sin_port = htons(static_cast<uint16_t>(port));
+    return true;
+}
+
+// Parses "<port>" or "<group>:<port>" into endpoint; returns false if it is neither
+bool parse_discovery(const std::string &spec, sockaddr_in &endpoint)
+{
+    if (spec.find(':') != std::string::npos)
+    {
+        return parse_multicast(spec, endpoint);
+    }
+    int port = 0;
+    if (!parse_int(spec, 1, 65535, port))
+    {
+        return false;
+    }
+    endpoint.sin_family = AF_INET;
+    endpoint.sin_addr.s_addr = htonl(INADDR_ANY);
+    endpoint.sin_port = htons(static_cast<uint16_t>(port));
+    return true;
+}
 
-        while (std::getline(ss, segment, ';'))
+// Loads a --fleet file into fleet: one device per line as port,model,serial[,channels[,signal]], the
+// signal being a --signal spec taking the rest of the line. Devices that leave out channels or signal
+// get the given defaults. Blank lines and lines starting with # are skipped. Returns false, with
+// error set to the line at fault, on a line that does not parse or a port given twice.
+bool load_fleet(const std::string &path, size_t channels, const std::shared_ptr<const SignalModel> &signal,
+                std::vector<FleetDevice> &fleet, std::string &error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::vector<bool> ports(65536);
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++)
+    {
+        if (!line.empty() && line.back() == '\r')
         {
-            if (first_segment)
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::string_view fields[4];
+        size_t count = 0;
+        std::string_view rest(line);
+        while (count < 4)
+        {
+            size_t comma = rest.find(',');
+            fields[count++] = rest.substr(0, comma);
+            rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+            if (comma == std::string_view::npos)
             {
-                data["TYPE"] = segment;
-                first_segment = false;
-                continue;
+                break;
             }
+        }
 
-            std::size_t delimiter_position = segment.find('=');
+        FleetDevice device{0, std::string(count > 1 ? fields[1] : std::string_view()), 0, channels, signal};
+        int device_channels = static_cast<int>(channels);
+        bool valid = count >= 3 && parse_int(fields[0], 1, 65535, device.port) && !device.model.empty() &&
+                     parse_int(fields[2], INT_MIN, INT_MAX, device.serial) &&
+                     (count < 4 || parse_int(fields[3], 1, static_cast<int>(Device::kMaxChannels), device_channels));
+        if (valid && !rest.empty())
+        {
+            valid = (device.signal = make_signal_model(rest, true)) != nullptr;
+        }
+        if (!valid || ports[device.port])
+        {
+            error = path + ":" + std::to_string(number) + ": " + (valid ? "port given twice: " : "invalid device: ") + line;
+            return false;
+        }
+        ports[device.port] = true;
+        device.channels = static_cast<size_t>(device_channels);
+        fleet.push_back(std::move(device));
+    }
+    if (fleet.empty())
+    {
+        error = path + ": no devices";
+        return false;
+    }
+    return true;
+}
 
-            if (delimiter_position != std::string::npos)
-            {
-                std::string key = segment.substr(0, delimiter_position);
-                std::string value = segment.substr(delimiter_position + 1);
+// Descriptors a host needs besides its devices' sockets: stdio, the epoll, timer and wake descriptors
+// of every worker, the signal and discovery sockets and capture files being created, with room to spare
+constexpr size_t kSpareDescriptors = 64;
 
-                data[key] = value;
-            }
-            else
-            {
-                std::cerr << "Invalid message format: Missing \"=\" in a segment." << std::endl;
-                data.clear();
-                return data;
-            }
+// Makes room for needed open descriptors, raising the soft RLIMIT_NOFILE up to the hard limit if the
+// soft one is lower. Returns false, with available set to the most the process may open, if even the
+// hard limit is too low.
+bool reserve_descriptors(size_t needed, size_t &available)
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+    {
+        perror("Error reading the open file limit");
+        available = needed;
+        return true; // carry on; binding reports any shortage
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < needed && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+        {
+            perror("Error raising the open file limit");
+            getrlimit(RLIMIT_NOFILE, &limit);
         }
-
-        return data;
     }
+    available = limit.rlim_cur == RLIM_INFINITY ? SIZE_MAX : static_cast<size_t>(limit.rlim_cur);
+    return available >= needed;
+}
 
-    // Fulfills a parsed request and sends an appropriate response
-    void fulfill_request(std::map<std::string, std::string> request, sockaddr_in client_addr)
+// Main function: creates a DeviceServer (or a DeviceHost) and starts it
+#ifndef DEVICE_NO_MAIN // microbench.cpp includes this file and brings its own main
+int main(int argc, char *argv[])
+{
+    WorkerPool::block_shutdown_signals();
+
+    // Pull the options out of argv, leaving the positional arguments in place
+    std::shared_ptr<const SignalModel> signal = std::make_shared<NoiseSignal>();
+    size_t channels = 1;
+    size_t workers = 1;
+    sockaddr_in multicast{};
+    sockaddr_in discovery{};
+    std::string capture_dir;
+    std::string fleet_path;
+    int positional = 1;
+    for (int i = 1; i < argc; i++)
     {
-        if (request.find("TYPE") != request.end() && request["TYPE"] == "ID")
+        if (std::string(argv[i]) == "--capture")
         {
-            send_message({{"TYPE", "ID"},
-                          {"MODEL", this->device_.model()},
-                          {"SERIAL", std::to_string(this->device_.serial_number())}},
-                         client_addr);
-            return;
+            if (i + 1 == argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            capture_dir = argv[++i];
+            continue;
         }
-        else if (request.find("TYPE") != request.end() && request["TYPE"] == "TEST")
+        if (std::string(argv[i]) == "--fleet")
         {
-            if (request.find("CMD") != request.end() && request["CMD"] == "START")
+            if (i + 1 == argc)
             {
-                if (test_running_)
-                {
-                    send_message({{"TYPE", "TEST"},
-                                  {"RESULT", "ERROR1"},
-                                  {"MSG", "Attempting to start testing on a device that is already testing"}},
-                                 client_addr);
-                    return;
-                }
-                else
-                {
-                    std::chrono::milliseconds test_rate{std::stoi(request["RATE"])};
-                    std::chrono::seconds test_duration{std::stoi(request["DURATION"])};
-                    std::thread([this, test_rate, test_duration, client_addr]
-                                { this->start_test(test_rate, test_duration, client_addr); })
-                        .detach();
-                    return;
-                }
+                print_usage(argv[0]);
+                return 1;
+            }
+            fleet_path = argv[++i];
+            continue;
+        }
+        if (std::string(argv[i]) == "--discovery")
+        {
+            if (i + 1 == argc || !parse_discovery(argv[i + 1], discovery))
+            {
+                std::cerr << "Invalid discovery endpoint" << std::endl;
+                print_usage(argv[0]);
+                return 1;
             }
-            else if (request.find("TYPE") != request.end() && request["CMD"] == "STOP")
+            i++;
+            continue;
+        }
+        if (std::string(argv[i]) == "--multicast")
+        {
+            if (i + 1 == argc || !parse_multicast(argv[i + 1], multicast))
             {
-                if (!test_running_)
-                {
-                    send_message({{"TYPE", "TEST"},
-                                  {"RESULT", "ERROR2"},
-                                  {"MSG", "Attempting to stop testing on a device that is not testing"}},
-                                 client_addr);
-                    return;
-                }
-                else
-                {
-                    this->device_.set_is_idle(true);
-                    while (test_running_)
-                    {
-                        std::this_thread::yield(); // yield the current thread while waiting
-                    }
-                    send_message({{"TYPE", "TEST"},
-                                  {"RESULT", "STOPPED"}},
-                                 client_addr);
-                    send_message({{"TYPE", "STATUS"}, {"STATE", "IDLE"}}, client_addr);
-                    return;
-                }
+                std::cerr << "Invalid multicast group" << std::endl;
+                print_usage(argv[0]);
+                return 1;
             }
+            i++;
+            continue;
         }
-        std::cerr << "Invalid request received" << std::endl;
-    }
-
-    // Starts a test, periodically sending device status to the client
-    void start_test(std::chrono::milliseconds rate, std::chrono::seconds duration, sockaddr_in client_addr)
-    {
-        this->device_.set_is_idle(false);
-        auto start_time = std::chrono::steady_clock::now();
-        auto end_time = start_time + duration;
-
-        send_message({{"TYPE", "TEST"},
-                      {"RESULT", "STARTED"}},
-                     client_addr);
-
-        test_running_ = true;
-        while (this->device_.is_idle() == false && std::chrono::steady_clock::now() <= end_time)
-        {
-            send_message({{"TYPE", "STATUS"},
-                          {"TIME", std::to_string(
-                                       std::chrono::duration_cast<std::chrono::milliseconds>(
-                                           std::chrono::steady_clock::now() - start_time)
-                                           .count() /
-                                       1000.0)},
-                          {"MV", std::to_string(this->device_.get_millivolts())},
-                          {"MA", std::to_string(this->device_.get_milliamps())}},
-                         client_addr);
-            std::this_thread::sleep_for(rate);
-        }
-        test_running_ = false;
-        if (this->device_.is_idle() == false) // in the case that the test was stopped early
+        if (std::string(argv[i]) == "--log-level")
         {
-            this->device_.set_is_idle(true);
-            send_message({{"TYPE", "STATUS"}, {"STATE", "IDLE"}}, client_addr);
+            LogLevel level;
+            if (i + 1 == argc || !parse_log_level(argv[i + 1], level))
+            {
+                std::cerr << "Invalid log level" << std::endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+            Logger::instance().set_level(level);
+            i++;
+            continue;
+        }
+        if (std::string(argv[i]) == "--trace-rate")
+        {
+            int value;
+            if (i + 1 == argc || !parse_int(argv[i + 1], 0, INT_MAX, value))
+            {
+                std::cerr << "Invalid trace rate" << std::endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+            Logger::instance().set_trace_rate(static_cast<uint32_t>(value));
+            i++;
+            continue;
+        }
+        if (std::string(argv[i]) == "--workers")
+        {
+            int value;
+            if (i + 1 == argc || !parse_int(argv[i + 1], 1, static_cast<int>(WorkerPool::kMaxWorkers), value))
+            {
+                std::cerr << "Invalid worker count" << std::endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+            workers = static_cast<size_t>(value);
+            i++;
+            continue;
+        }
+        if (std::string(argv[i]) == "--channels")
+        {
+            int value;
+            if (i + 1 == argc || !parse_int(argv[i + 1], 1, static_cast<int>(Device::kMaxChannels), value))
+            {
+                std::cerr << "Invalid channel count" << std::endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+            channels = static_cast<size_t>(value);
+            i++;
+            continue;
+        }
+        if (std::string(argv[i]) == "--signal")
+        {
+            if (i + 1 == argc || (signal = make_signal_model(argv[i + 1], true)) == nullptr)
+            {
+                std::cerr << "Invalid signal model" << std::endl;
+                print_usage(argv[0]);
+                return 1;
+            }
+            i++;
+            continue;
         }
+        argv[positional++] = argv[i];
     }
+    argc = positional;
 
-    // Converts a given string to ISO 8859-1 encoding
-    std::string to_iso_8859_1(const std::string &input)
+    // Multi-device host mode: many devices served from one process, on consecutive ports or as
+    // listed in a fleet file
+    bool host_mode = argc >= 2 && std::string(argv[1]) == "--host";
+    if (host_mode || !fleet_path.empty())
     {
-        std::string output;
-        output.reserve(input.size());
+        std::vector<FleetDevice> fleet;
+        if (!fleet_path.empty())
+        {
+            std::string error;
+            if (argc != 1)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            if (!load_fleet(fleet_path, channels, signal, fleet, error))
+            {
+                std::cerr << "Invalid fleet file: " << error << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            if (argc != 6)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            int base_port, first_serial, count;
+            if (!parse_int(argv[2], 1, 65535, base_port) || !parse_int(argv[4], INT_MIN, INT_MAX, first_serial) ||
+                !parse_int(argv[5], 1, 65535, count) || base_port + count - 1 > 65535 || first_serial > INT_MAX - (count - 1))
+            {
+                std::cerr << "Invalid port range, serial or device count" << std::endl;
+                return 1;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                fleet.push_back(FleetDevice{base_port + i, argv[3], first_serial + i, channels, signal});
+            }
+        }
+        if (multicast.sin_family == AF_INET && ntohs(multicast.sin_port) + fleet.size() - 1 > 65535)
+        {
+            std::cerr << "Invalid port range or device count" << std::endl;
+            return 1;
+        }
 
-        for (unsigned char c : input)
+        // every device has a socket on each worker: its own, and the others' SO_REUSEPORT shards
+        size_t needed = fleet.size() * workers + 4 * workers + kSpareDescriptors;
+        size_t available;
+        if (!reserve_descriptors(needed, available))
         {
-            output.push_back(static_cast<char>(c));
+            std::cerr << "Serving " << fleet.size() << " devices on " << workers << " workers needs " << needed
+                      << " open files, but the limit is " << available << " (raise the hard limit, i.e. ulimit -Hn)" << std::endl;
+            return 1;
         }
 
-        return output;
+        DeviceHost host(fleet, workers, multicast.sin_family == AF_INET ? &multicast : nullptr,
+                        discovery.sin_family == AF_INET ? &discovery : nullptr, capture_dir);
+        host.run();
+        return 0;
     }
-};
 
-// Main function: creates a DeviceServer and starts it
-int main(int argc, char *argv[])
-{
     // Check for correct number of command-line arguments
     if (argc != 2 && argc != 4)
     {
-        std::cerr << "Usage: " << argv[0] << " <port>";
-        std::cerr << " OR: " << argv[0] << " <port> <model> <serial>" << std::endl;
+        print_usage(argv[0]);
         return 1;
     }
 
     // Parse the port number from the command line
-    int port = std::stoi(argv[1]);
+    int port;
+    if (!parse_int(argv[1], 1, 65535, port))
+    {
+        std::cerr << "Invalid port" << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
 
     // Parse the model and serial number from the command line
     std::string model;
@@ -308,7 +5030,12 @@ int main(int argc, char *argv[])
     if (argc >= 3)
     {
         model = argv[2];
-        serial = std::stoi(argv[3]);
+        if (!parse_int(argv[3], INT_MIN, INT_MAX, serial))
+        {
+            std::cerr << "Invalid serial number" << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        }
     }
     else
     {
@@ -317,10 +5044,17 @@ int main(int argc, char *argv[])
     }
 
     // Create a device instance and a server instance
-    Device device(model, serial);
+    Device device(model, serial, channels);
+    device.set_signal(signal);
     DeviceServer server(port, device);
+    if (multicast.sin_family == AF_INET)
+    {
+        server.set_multicast(multicast);
+    }
+    server.set_capture_dir(capture_dir);
 
     // Start the server
-    server.start();
+    server.start(workers, discovery.sin_family == AF_INET ? &discovery : nullptr);
     return 0;
-}
\ No newline at end of file
+}
+#endif // DEVICE_NO_MAIN
@@ -0,0 +1,503 @@
+// Load generator for the simulated device server: M clients run ID / TEST START / (STOP) rounds against
+// one or more devices and the run is summed up as throughput, STATUS inter-arrival quantiles, frame
+// loss and CPU per frame. A client that finds its device already testing subscribes to that test.
+// Usage: see print_usage() or `make bench`.
+
+// Required libraries
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+
+using Clock = std::chrono::steady_clock;
+
+// Settings of one run, from the command line
+struct LoadOptions
+{
+    std::string host = "127.0.0.1";
+    int port = 7000;       // first device's port
+    int devices = 1;       // devices on consecutive ports; client i talks to device i % devices
+    int clients = 1;
+    int rounds = 1;        // ID / START / STOP rounds per client
+    int rate_ms = 1;
+    int duration_s = 2;
+    int batch = 1;
+    bool binary = false;
+    int stop_after_ms = 0; // send STOP this long into each test (0 = let it run to IDLE)
+    int server_pid = 0;    // read the server's CPU time from /proc when set
+};
+
+// Client is one simulated user of a device, stepping through its rounds as replies arrive
+struct Client
+{
+    enum class State
+    {
+        AwaitId,
+        AwaitStarted,
+        Streaming,
+        AwaitStopped,
+        Done
+    };
+
+    int fd = -1;
+    sockaddr_in device{};
+    State state = State::AwaitId;
+    int round = 0;
+    Clock::time_point deadline;    // reply timeout, or when to send STOP while streaming
+    Clock::time_point last_frame;  // arrival of the previous STATUS frame of this test
+    bool have_frame = false;
+    bool starter = false;          // started this test, rather than subscribing to another client's
+    uint32_t min_sequence = 0;     // lowest and highest sequence seen this test
+    uint32_t max_sequence = 0;
+    uint64_t test_frames = 0;      // frames received this test
+};
+
+// Totals over every client
+struct LoadReport
+{
+    uint64_t frames = 0;
+    uint64_t samples = 0;
+    uint64_t lost = 0;             // sequence numbers never received
+    uint64_t errors = 0;           // timeouts and error replies
+    uint64_t tests = 0;            // started or joined
+    std::vector<int64_t> gaps_ns;  // STATUS inter-arrival times
+};
+
+// Reads utime + stime of process pid in seconds; returns -1 if it cannot be read
+double process_cpu_seconds(int pid)
+{
+    std::string path = "/proc/" + std::to_string(pid) + "/stat";
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == nullptr)
+    {
+        return -1;
+    }
+    char buffer[1024];
+    size_t length = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[length] = '\0';
+
+    // fields after the parenthesised command name: state is field 3, utime 14, stime 15
+    const char *rest = strrchr(buffer, ')');
+    unsigned long utime = 0, stime = 0;
+    if (rest == nullptr || sscanf(rest + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+    {
+        return -1;
+    }
+    return static_cast<double>(utime + stime) / static_cast<double>(sysconf(_SC_CLK_TCK));
+}
+
+double own_cpu_seconds()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// LoadGenerator drives every client from one epoll loop
+class LoadGenerator
+{
+public:
+    explicit LoadGenerator(const LoadOptions &options) : options_(options) {}
+
+    ~LoadGenerator()
+    {
+        for (Client &client : this->clients_)
+        {
+            if (client.fd >= 0)
+            {
+                close(client.fd);
+            }
+        }
+        if (this->epoll_fd_ >= 0)
+        {
+            close(this->epoll_fd_);
+        }
+    }
+
+    // Runs every client to completion; returns false if the sockets could not be set up
+    bool run()
+    {
+        this->epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (this->epoll_fd_ < 0)
+        {
+            perror("Error creating epoll instance");
+            return false;
+        }
+
+        this->clients_.resize(static_cast<size_t>(this->options_.clients));
+        for (size_t i = 0; i < this->clients_.size(); i++)
+        {
+            Client &client = this->clients_[i];
+            client.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (client.fd < 0)
+            {
+                perror("Error creating client socket");
+                return false;
+            }
+            int buffer_size = 4 << 20; // a stalled round must not drop frames in our own socket
+            setsockopt(client.fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+            client.device.sin_family = AF_INET;
+            client.device.sin_port = htons(static_cast<uint16_t>(this->options_.port + static_cast<int>(i) % this->options_.devices));
+            if (inet_pton(AF_INET, this->options_.host.c_str(), &client.device.sin_addr) != 1)
+            {
+                std::cerr << "Invalid host address" << std::endl;
+                return false;
+            }
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = i;
+            if (epoll_ctl(this->epoll_fd_, EPOLL_CTL_ADD, client.fd, &event) < 0)
+            {
+                perror("Error registering client socket");
+                return false;
+            }
+            begin_round(client);
+        }
+
+        double server_cpu = this->options_.server_pid != 0 ? process_cpu_seconds(this->options_.server_pid) : -1;
+        double own_cpu = own_cpu_seconds();
+        auto started = Clock::now();
+        size_t active = this->clients_.size();
+        epoll_event events[64];
+        while (active != 0)
+        {
+            int ready = epoll_wait(this->epoll_fd_, events, 64, 1);
+            if (ready < 0 && errno != EINTR)
+            {
+                perror("Error waiting for events");
+                return false;
+            }
+            for (int i = 0; i < ready; i++)
+            {
+                receive(this->clients_[events[i].data.u64]);
+            }
+            auto now = Clock::now();
+            active = 0;
+            for (Client &client : this->clients_)
+            {
+                if (client.state != Client::State::Done && now >= client.deadline)
+                {
+                    on_deadline(client);
+                }
+                active += client.state != Client::State::Done;
+            }
+        }
+        double elapsed = std::chrono::duration<double>(Clock::now() - started).count();
+        double server_used = server_cpu >= 0 ? process_cpu_seconds(this->options_.server_pid) - server_cpu : -1;
+        print_report(elapsed, server_used, own_cpu_seconds() - own_cpu);
+        return true;
+    }
+
+private:
+    // Member variables
+    LoadOptions options_;
+    std::vector<Client> clients_;
+    int epoll_fd_ = -1;
+    LoadReport report_;
+
+    static constexpr std::chrono::seconds kReplyTimeout{1};
+
+    void send(Client &client, const std::string &message)
+    {
+        if (sendto(client.fd, message.data(), message.size(), 0, reinterpret_cast<const sockaddr *>(&client.device), sizeof(client.device)) < 0)
+        {
+            perror("Error sending request");
+        }
+    }
+
+    void begin_round(Client &client)
+    {
+        if (client.round == this->options_.rounds)
+        {
+            client.state = Client::State::Done;
+            return;
+        }
+        client.round++;
+        client.state = Client::State::AwaitId;
+        client.deadline = Clock::now() + kReplyTimeout;
+        send(client, "ID;");
+    }
+
+    // Ends a test whose device reported sent frames in its IDLE (-1 if the test ended without one):
+    // counts the sequence numbers that never arrived, then starts the next round. The starter expects
+    // every frame from 0, a subscriber every one from the first it saw; without IDLE, frames after the
+    // last one received cannot be told apart from frames never sent, and are not counted.
+    void end_test(Client &client, int64_t sent = -1)
+    {
+        uint64_t first = client.starter ? 0 : client.min_sequence;
+        uint64_t end = client.test_frames == 0 ? first : uint64_t{client.max_sequence} + 1;
+        if (sent >= 0 && (client.starter || client.test_frames > 0))
+        {
+            end = std::max(end, static_cast<uint64_t>(sent));
+        }
+        uint64_t expected = end - first;
+        if (expected > client.test_frames)
+        {
+            this->report_.lost += expected - client.test_frames;
+        }
+        this->report_.tests++;
+        begin_round(client);
+    }
+
+    void on_deadline(Client &client)
+    {
+        if (client.state == Client::State::Streaming && this->options_.stop_after_ms > 0)
+        {
+            client.state = Client::State::AwaitStopped;
+            client.deadline = Clock::now() + kReplyTimeout;
+            send(client, "TEST;CMD=STOP;");
+            return;
+        }
+        this->report_.errors++; // no reply (or no IDLE) in time
+        if (client.state == Client::State::Streaming || client.state == Client::State::AwaitStopped)
+        {
+            end_test(client);
+            return;
+        }
+        begin_round(client);
+    }
+
+    void receive(Client &client)
+    {
+        char buffer[2048];
+        while (true)
+        {
+            ssize_t length = recv(client.fd, buffer, sizeof(buffer), 0);
+            if (length < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    perror("Error receiving reply");
+                }
+                return;
+            }
+            on_datagram(client, std::string_view(buffer, static_cast<size_t>(length)));
+        }
+    }
+
+    void on_datagram(Client &client, std::string_view data)
+    {
+        if (!data.empty() && data[0] == '\0')
+        {
+            // binary STATUS frame: u32 sequence at offset 4, u16 sample count at offset 8
+            if (data.size() >= 12)
+            {
+                uint32_t sequence;
+                uint16_t count;
+                std::memcpy(&sequence, data.data() + 4, 4);
+                std::memcpy(&count, data.data() + 8, 2);
+                on_frame(client, sequence, count);
+            }
+            return;
+        }
+
+        if (data.rfind("ID;", 0) == 0 && client.state == Client::State::AwaitId)
+        {
+            std::string start = "TEST;CMD=START;DURATION=" + std::to_string(this->options_.duration_s) +
+                                ";RATE=" + std::to_string(this->options_.rate_ms) + ";";
+            if (this->options_.batch > 1)
+            {
+                start += "BATCH=" + std::to_string(this->options_.batch) + ";";
+            }
+            if (this->options_.binary)
+            {
+                start += "FORMAT=BIN;";
+            }
+            client.state = Client::State::AwaitStarted;
+            client.deadline = Clock::now() + kReplyTimeout;
+            send(client, start);
+        }
+        else if (data.rfind("TEST;", 0) == 0)
+        {
+            on_test_reply(client, data);
+        }
+        else if (data.rfind("STATUS;", 0) == 0)
+        {
+            if (data.find("STATE=IDLE;") != std::string_view::npos)
+            {
+                if (client.state == Client::State::Streaming || client.state == Client::State::AwaitStopped)
+                {
+                    size_t frames = data.find(";FRAMES=");
+                    end_test(client, frames == std::string_view::npos ? -1 : std::strtoll(data.data() + frames + 8, nullptr, 10));
+                }
+                return;
+            }
+            size_t seq = data.find(";SEQ=");
+            size_t time = data.find(";TIME=");
+            if (seq == std::string_view::npos || time == std::string_view::npos)
+            {
+                return;
+            }
+            uint32_t sequence = static_cast<uint32_t>(std::strtoul(data.data() + seq + 5, nullptr, 10));
+            size_t end = data.find(';', time + 1);
+            size_t count = 1 + static_cast<size_t>(std::count(data.begin() + static_cast<std::ptrdiff_t>(time), data.begin() + static_cast<std::ptrdiff_t>(end), ','));
+            on_frame(client, sequence, count);
+        }
+    }
+
+    void on_test_reply(Client &client, std::string_view data)
+    {
+        bool started = data.find("RESULT=STARTED;") != std::string_view::npos;
+        if ((started || data.find("RESULT=SUBSCRIBED;") != std::string_view::npos) && client.state == Client::State::AwaitStarted)
+        {
+            client.state = Client::State::Streaming;
+            client.have_frame = false;
+            client.starter = started;
+            client.test_frames = 0;
+            auto now = Clock::now();
+            client.deadline = this->options_.stop_after_ms > 0 && started
+                                  ? now + std::chrono::milliseconds{this->options_.stop_after_ms}
+                                  : now + std::chrono::seconds{this->options_.duration_s} + kReplyTimeout;
+        }
+        else if (data.find("RESULT=ERROR1;") != std::string_view::npos && client.state == Client::State::AwaitStarted)
+        {
+            // another client is testing this device: follow its test instead
+            client.deadline = Clock::now() + kReplyTimeout;
+            send(client, "TEST;CMD=SUBSCRIBE;");
+        }
+        else if (data.find("RESULT=ERROR2;") != std::string_view::npos && client.state == Client::State::AwaitStarted)
+        {
+            begin_round(client); // the test we tried to follow has just ended
+        }
+        else if (data.find("RESULT=STOPPED;") != std::string_view::npos && client.state == Client::State::AwaitStopped)
+        {
+            client.deadline = Clock::now() + kReplyTimeout; // IDLE follows
+        }
+        else if (data.find("RESULT=ERROR") != std::string_view::npos)
+        {
+            this->report_.errors++;
+            if (client.state == Client::State::AwaitStarted)
+            {
+                begin_round(client);
+            }
+        }
+    }
+
+    void on_frame(Client &client, uint32_t sequence, size_t samples)
+    {
+        if (client.state != Client::State::Streaming && client.state != Client::State::AwaitStopped)
+        {
+            return;
+        }
+        auto now = Clock::now();
+        if (client.have_frame)
+        {
+            this->report_.gaps_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - client.last_frame).count());
+        }
+        client.min_sequence = client.test_frames == 0 ? sequence : std::min(client.min_sequence, sequence);
+        client.max_sequence = client.test_frames == 0 ? sequence : std::max(client.max_sequence, sequence);
+        client.have_frame = true;
+        client.last_frame = now;
+        client.test_frames++;
+        this->report_.frames++;
+        this->report_.samples += samples;
+    }
+
+    void print_report(double elapsed, double server_cpu, double own_cpu)
+    {
+        LoadReport &report = this->report_;
+        std::sort(report.gaps_ns.begin(), report.gaps_ns.end());
+        auto quantile = [&report](double q)
+        {
+            if (report.gaps_ns.empty())
+            {
+                return 0.0;
+            }
+            size_t index = static_cast<size_t>(q * static_cast<double>(report.gaps_ns.size() - 1));
+            return static_cast<double>(report.gaps_ns[index]) / 1000.0;
+        };
+        uint64_t expected = report.frames + report.lost;
+
+        printf("clients %d, devices %d, rounds %d, RATE=%d ms, BATCH=%d, %s frames\n", this->options_.clients,
+               this->options_.devices, this->options_.rounds, this->options_.rate_ms, this->options_.batch,
+               this->options_.binary ? "binary" : "text");
+        printf("tests     %llu in %.2f s, %llu errors\n", static_cast<unsigned long long>(report.tests), elapsed,
+               static_cast<unsigned long long>(report.errors));
+        printf("frames    %llu (%.0f/s), samples %llu (%.0f/s)\n", static_cast<unsigned long long>(report.frames),
+               static_cast<double>(report.frames) / elapsed, static_cast<unsigned long long>(report.samples),
+               static_cast<double>(report.samples) / elapsed);
+        printf("lost      %llu frames (%.3f%%)\n", static_cast<unsigned long long>(report.lost),
+               expected == 0 ? 0.0 : 100.0 * static_cast<double>(report.lost) / static_cast<double>(expected));
+        printf("interval  p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us\n", quantile(0.5), quantile(0.99),
+               quantile(0.999), quantile(1.0));
+        if (server_cpu >= 0 && report.frames != 0)
+        {
+            printf("server    %.3f s CPU, %.2f us/frame\n", server_cpu, server_cpu * 1e6 / static_cast<double>(report.frames));
+        }
+        if (report.frames != 0)
+        {
+            printf("loadgen   %.3f s CPU, %.2f us/frame\n", own_cpu, own_cpu * 1e6 / static_cast<double>(report.frames));
+        }
+    }
+};
+
+// Prints the command-line usage
+void print_usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options]" << std::endl;
+    std::cerr << "Options: --host <ip> (default 127.0.0.1)   --port <first device port> (default 7000)" << std::endl;
+    std::cerr << "         --devices <N> (devices on consecutive ports)   --clients <M>   --rounds <R>" << std::endl;
+    std::cerr << "         --rate <ms>   --duration <s>   --batch <samples>   --binary" << std::endl;
+    std::cerr << "         --stop-after <ms> (STOP each test early)   --server-pid <pid> (report the server's CPU time)" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    LoadOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        if (option == "--binary")
+        {
+            options.binary = true;
+            continue;
+        }
+        if (i + 1 == argc)
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (option == "--host")
+        {
+            options.host = value;
+            continue;
+        }
+
+        const std::pair<const char *, int *> numbers[] = {
+            {"--port", &options.port}, {"--devices", &options.devices}, {"--clients", &options.clients},
+            {"--rounds", &options.rounds}, {"--rate", &options.rate_ms}, {"--duration", &options.duration_s},
+            {"--batch", &options.batch}, {"--stop-after", &options.stop_after_ms}, {"--server-pid", &options.server_pid}};
+        auto match = std::find_if(std::begin(numbers), std::end(numbers), [&option](const std::pair<const char *, int *> &entry)
+                                  { return option == entry.first; });
+        if (match == std::end(numbers))
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+        *match->second = std::atoi(value.c_str());
+    }
+    if (options.port <= 0 || options.devices < 1 || options.clients < 1 || options.rounds < 1 ||
+        options.rate_ms < 1 || options.duration_s < 0 || options.batch < 1 || options.stop_after_ms < 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    LoadGenerator generator(options);
+    return generator.run() ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+// Microbenchmarks (Google Benchmark) for the request path: parsing requests, encoding replies and
+// STATUS frames, and fulfill_request dispatch. Each benchmark also reports heap allocations per
+// operation, counted by the replacement operator new below. Build and run with `make bench-micro`.
+
+#define DEVICE_NO_MAIN
+#include "device.cpp"
+
+#include <benchmark/benchmark.h>
+#include <new>
+#include <cstdlib>
+
+// Every allocation in the process goes through here, so a benchmark can tell how many its loop made.
+// (GCC cannot see that the replacement new and delete below pair malloc with free.)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+static std::atomic<uint64_t> g_allocations{0};
+
+void *operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *block = std::malloc(size == 0 ? 1 : size))
+    {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *block) noexcept { std::free(block); }
+void operator delete(void *block, size_t) noexcept { std::free(block); }
+
+// Reports the allocations made since start as allocs/op
+static void report_allocations(benchmark::State &state, uint64_t start)
+{
+    state.counters["allocs/op"] = benchmark::Counter(static_cast<double>(g_allocations.load() - start),
+                                                     benchmark::Counter::kAvgIterations);
+}
+
+// A realistic full text STATUS frame: 64 samples of MA, MV and TIME
+static std::string status_payload()
+{
+    std::string ma, mv, time;
+    for (int i = 0; i < 64; i++)
+    {
+        ma += (i ? "," : "") + std::to_string(10 + i % 90);
+        mv += (i ? "," : "") + std::to_string(2000 + 37 * i % 2800);
+        char seconds[16];
+        snprintf(seconds, sizeof(seconds), "%s%d.%03d", i ? "," : "", i / 1000, i % 1000);
+        time += seconds;
+    }
+    return "STATUS;MA=" + ma + ";MV=" + mv + ";TIME=" + time + ";SEQ=42;";
+}
+
+static void parse(benchmark::State &state, const std::string &payload)
+{
+    Request request;
+    uint64_t start = g_allocations.load();
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(request.parse(payload));
+        benchmark::DoNotOptimize(request.type());
+    }
+    report_allocations(state, start);
+}
+
+static void BM_ParseId(benchmark::State &state) { parse(state, "ID;"); }
+static void BM_ParseTestStart(benchmark::State &state) { parse(state, "TEST;CMD=START;DURATION=60;RATE=10;FORMAT=BIN;BATCH=8;LATENCY=50;"); }
+static void BM_ParseStatus(benchmark::State &state) { parse(state, status_payload()); }
+BENCHMARK(BM_ParseId);
+BENCHMARK(BM_ParseTestStart);
+BENCHMARK(BM_ParseStatus);
+
+// The ID reply send_id builds
+static void BM_EncodeId(benchmark::State &state)
+{
+    uint64_t start = g_allocations.load();
+    for (auto _ : state)
+    {
+        FrameEncoder frame(kTypeId);
+        frame.add(kKeyModel, "default_model").add(kKeySerial, 12345).add(kKeySignal, "NOISE").add(kKeyChannels, 1);
+        benchmark::DoNotOptimize(frame.view().data());
+    }
+    report_allocations(state, start);
+}
+BENCHMARK(BM_EncodeId);
+
+// DeviceServerBench reaches into DeviceServer (it is a friend) to time its private request path
+struct DeviceServerBench
+{
+    Device device{"default_model", 12345};
+    EventLoop loop;
+    Sampler sampler;
+    DeviceServer server{0, device}; // port 0: any free port
+    sockaddr_in client{};
+
+    DeviceServerBench()
+    {
+        Logger::instance().set_level(LogLevel::Warn); // keep trace lines out of the timings
+        this->server.bind_sockets(1); // one shard, served from the same loop
+        this->server.attach(this->loop, this->sampler);
+        this->server.attach_shard(0, this->loop);
+        this->client.sin_family = AF_INET;
+        this->client.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        this->client.sin_port = htons(9); // discard: replies go nowhere
+    }
+
+    ~DeviceServerBench()
+    {
+        this->loop.flush_sends();
+        this->server.detach_loop();
+        this->sampler.shutdown();
+    }
+
+    void fulfill(const Request &request) { this->server.fulfill_request(request, this->client); }
+
+    // Encodes a full batch of samples as one STATUS frame in format
+    static void encode(benchmark::State &state, FrameFormat format)
+    {
+        SampleBatch batch(1);
+        batch.allocate();
+        size_t count = format == FrameFormat::Binary ? SampleBatch::max_binary(1) : SampleBatch::max_text(1);
+        for (size_t i = 0; i < count; i++)
+        {
+            int32_t mv = static_cast<int32_t>(2000 + 37 * i % 2800), ma = static_cast<int32_t>(10 + i % 90);
+            batch.push(static_cast<int64_t>(i), &mv, &ma);
+        }
+        uint64_t start = g_allocations.load();
+        uint32_t sequence = 0;
+        for (auto _ : state)
+        {
+            DeviceServer::encode_batch(batch, format, sequence++, 0, FrameClock(), [](const auto &frame)
+                                       { benchmark::DoNotOptimize(frame.view().data()); });
+        }
+        report_allocations(state, start);
+        state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(count));
+    }
+
+    // Times a request handed over from a shard socket: copied into the shard's ring as listen_shard()
+    // does, then parsed and fulfilled by drain_forwarded(). Replies are flushed as in fulfill() below.
+    static void forward(benchmark::State &state, std::string_view payload)
+    {
+        DeviceServerBench bench;
+        DeviceServer::Shard &shard = *bench.server.shards_[0];
+        uint64_t start = g_allocations.load();
+        size_t queued = 0;
+        for (auto _ : state)
+        {
+            DeviceServer::ForwardedRequest *slot = shard.forwarded.claim();
+            slot->client_addr = bench.client;
+            slot->length = payload.size();
+            std::memcpy(slot->text, payload.data(), payload.size());
+            shard.forwarded.publish();
+            bench.server.drain_forwarded(shard);
+            if (++queued == 256)
+            {
+                bench.loop.flush_sends();
+                queued = 0;
+            }
+        }
+        report_allocations(state, start);
+    }
+};
+
+static void BM_EncodeStatusText(benchmark::State &state) { DeviceServerBench::encode(state, FrameFormat::Text); }
+static void BM_EncodeStatusBinary(benchmark::State &state) { DeviceServerBench::encode(state, FrameFormat::Binary); }
+BENCHMARK(BM_EncodeStatusText);
+BENCHMARK(BM_EncodeStatusBinary);
+
+// Parses payload once, then times fulfill_request on it, reply encoding and queueing included.
+// Queued replies are flushed every 256 requests, so one sendmmsg call is amortised across them.
+static void fulfill(benchmark::State &state, const std::string &payload)
+{
+    DeviceServerBench bench;
+    Request request;
+    request.parse(payload);
+    uint64_t start = g_allocations.load();
+    size_t queued = 0;
+    for (auto _ : state)
+    {
+        bench.fulfill(request);
+        if (++queued == 256)
+        {
+            bench.loop.flush_sends();
+            queued = 0;
+        }
+    }
+    report_allocations(state, start);
+}
+
+static void BM_FulfillId(benchmark::State &state) { fulfill(state, "ID;"); }
+static void BM_FulfillStopIdle(benchmark::State &state) { fulfill(state, "TEST;CMD=STOP;"); } // ERROR2 reply
+static void BM_FulfillStats(benchmark::State &state) { fulfill(state, "STATS;"); }
+BENCHMARK(BM_FulfillId);
+BENCHMARK(BM_FulfillStopIdle);
+BENCHMARK(BM_FulfillStats);
+
+static void BM_ForwardStats(benchmark::State &state) { DeviceServerBench::forward(state, "STATS;"); }
+BENCHMARK(BM_ForwardStats);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,507 @@
+// Correctness checks for the device's building blocks (timer wheel, request parser, frame encoders,
+// SPSC ring, retransmit ring and capture file), run with `make check`. Each check drives one
+// component directly, with no sockets or threads where it can, and reports every failed expectation.
+// The process exits non-zero if any check failed.
+
+#define DEVICE_NO_MAIN
+#include "device.cpp"
+
+static int g_failures = 0;
+
+#define CHECK(condition)                                                            \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            g_failures++;                                                           \
+        }                                                                           \
+    } while (0)
+
+using std::chrono::milliseconds;
+using std::chrono::microseconds;
+
+// Runs the wheel the way Sampler::run does: sleep until next_wakeup(), then advance() to that time
+static TimerWheel::Clock::time_point run_wheel(TimerWheel &wheel, TimerWheel::Clock::time_point until)
+{
+    TimerWheel::Clock::time_point now{}, wakeup;
+    while (wheel.next_wakeup(wakeup) && wakeup <= until)
+    {
+        now = wakeup;
+        wheel.advance(now);
+    }
+    return now;
+}
+
+// A timer parked on level 1 must be cascaded at the boundary it is due at, not one span later
+static void check_wheel_boundary_cascade()
+{
+    const TimerWheel::Clock::time_point epoch = TimerWheel::Clock::now();
+    TimerWheel wheel(epoch);
+    int fired_255 = 0, fired_300 = 0;
+    TimerWheel::Timer first([&] { fired_255++; });
+    TimerWheel::Timer second([&] { fired_300++; });
+    wheel.schedule(first, epoch + milliseconds(255));
+    wheel.schedule(second, epoch + milliseconds(300));
+
+    wheel.advance(epoch + microseconds(255500));
+    CHECK(fired_255 == 1);
+    TimerWheel::Clock::time_point wakeup;
+    CHECK(wheel.next_wakeup(wakeup));
+    CHECK(wakeup == epoch + milliseconds(256)); // the cascade that brings down the +300 ms timer
+
+    wheel.advance(wakeup);
+    CHECK(wheel.next_wakeup(wakeup));
+    CHECK(wakeup == epoch + milliseconds(300));
+    wheel.advance(wakeup);
+    CHECK(fired_300 == 1);
+    CHECK(!wheel.next_wakeup(wakeup));
+}
+
+// Periodic jobs that live on the coarser levels between runs must still fire on their exact deadlines.
+// The first job always runs on the last tick of a span, so the wheel next stops on a cascade boundary.
+static void check_wheel_periodic()
+{
+    const TimerWheel::Clock::time_point epoch = TimerWheel::Clock::now();
+    TimerWheel wheel(epoch);
+    struct Job
+    {
+        TimerWheel::Clock::time_point deadline;
+        int runs = 0;
+        int64_t worst_late_ns = 0;
+    };
+    TimerWheel::Clock::time_point now = epoch;
+    Job jobs[2];
+    const int phases_ms[2] = {255, 300};
+    std::vector<std::unique_ptr<TimerWheel::Timer>> timers;
+    for (int i = 0; i < 2; i++)
+    {
+        Job &job = jobs[i];
+        timers.push_back(std::make_unique<TimerWheel::Timer>([&, i]
+                                                           {
+            Job &self = jobs[i];
+            int64_t late = std::chrono::duration_cast<std::chrono::nanoseconds>(now - self.deadline).count();
+            self.worst_late_ns = std::max(self.worst_late_ns, late);
+            self.runs++;
+            self.deadline += milliseconds(1024);
+            wheel.schedule(*timers[i], self.deadline); }));
+        job.deadline = epoch + milliseconds(phases_ms[i]);
+        wheel.schedule(*timers.back(), job.deadline);
+    }
+
+    TimerWheel::Clock::time_point wakeup;
+    while (wheel.next_wakeup(wakeup) && wakeup <= epoch + milliseconds(20480))
+    {
+        now = wakeup;
+        wheel.advance(now);
+    }
+    for (const Job &job : jobs)
+    {
+        CHECK(job.runs == 20);
+        CHECK(job.worst_late_ns == 0);
+    }
+}
+
+// Timers on every level, and timers scheduled from callbacks, run in deadline order
+static void check_wheel_order()
+{
+    const TimerWheel::Clock::time_point epoch = TimerWheel::Clock::now();
+    TimerWheel wheel(epoch);
+    std::vector<int> order;
+    TimerWheel::Timer far([&] { order.push_back(3); });
+    TimerWheel::Timer near([&] { order.push_back(1); });
+    TimerWheel::Timer chained([&] { order.push_back(2); });
+    TimerWheel::Timer spawner([&]
+                              {
+        order.push_back(0);
+        wheel.schedule(chained, epoch + milliseconds(70000)); });
+    wheel.schedule(far, epoch + milliseconds(300000)); // level 2
+    wheel.schedule(near, epoch + milliseconds(65536));
+    wheel.schedule(spawner, epoch + milliseconds(1));
+    TimerWheel::Timer cancelled([&] { order.push_back(-1); });
+    wheel.schedule(cancelled, epoch + milliseconds(2));
+    wheel.cancel(cancelled);
+
+    run_wheel(wheel, epoch + milliseconds(400000));
+    CHECK((order == std::vector<int>{0, 1, 2, 3}));
+}
+
+// DeviceServerCheck reaches into DeviceServer (it is a friend) to encode frames as a test does
+struct DeviceServerCheck
+{
+    template <typename Emit>
+    static void encode(const SampleBatch &batch, FrameFormat format, uint32_t sequence, uint8_t flags,
+                       const FrameClock &clock, Emit emit)
+    {
+        DeviceServer::encode_batch(batch, format, sequence, flags, clock, emit);
+    }
+};
+
+// A text frame of as many samples as max_text() allows, with the widest values, times and stamps
+// there can be, fits in the encoder's buffer for every channel count and test length
+static void check_text_frames_fit()
+{
+    CHECK(SampleBatch::max_text(1) == 64);
+    CHECK(SampleBatch::max_text(59) == 1);
+    const int64_t longest_ms[] = {60000, SampleBatch::kShortTestMs, 100000000, int64_t{INT_MAX} * 1000 + INT_MAX};
+    for (size_t channels = 1; channels <= Device::kMaxChannels; channels++)
+    {
+        for (int stamped = 0; stamped < 2; stamped++)
+        {
+            for (int summaries = 0; summaries < 2; summaries++)
+            {
+                for (int64_t max_time_ms : longest_ms)
+                {
+                    size_t columns = summaries ? channels * SampleBatch::kSummaryStats : channels;
+                    size_t count = SampleBatch::max_text(columns, stamped, summaries, max_time_ms);
+                    if (count == 0)
+                    {
+                        continue; // START and FETCH refuse this combination
+                    }
+                    SampleBatch batch(columns, summaries);
+                    batch.allocate();
+                    CHECK(count <= batch.capacity);
+                    std::vector<int32_t> widest(columns, INT16_MAX);
+                    for (size_t i = 0; i < count && i < batch.capacity; i++)
+                    {
+                        batch.push(max_time_ms, widest.data(), widest.data(), INT64_MAX);
+                    }
+                    FrameClock clock;
+                    if (stamped)
+                    {
+                        clock.unit = ClockUnit::Nano;
+                        clock.has_transmitted = true;
+                        clock.transmitted_sequence = UINT32_MAX;
+                        clock.transmitted_time = INT64_MAX;
+                    }
+                    bool fits = false;
+                    DeviceServerCheck::encode(batch, FrameFormat::Text, UINT32_MAX, BinaryFrameEncoder::kFlagReplay, clock,
+                                              [&](const auto &frame)
+                                              { fits = frame.ok(); });
+                    if (!fits)
+                    {
+                        fprintf(stderr, "Text frame of %zu channel(s), stamped %d, summaries %d, TIME up to %lld ms does not fit\n",
+                                channels, stamped, summaries, static_cast<long long>(max_time_ms));
+                        g_failures++;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Requests parse into their type, command and fields; malformed ones are refused
+static void check_request_parse()
+{
+    Request request;
+    CHECK(request.parse("TEST;CMD=START;DURATION=60;RATE=10;FORMAT=BIN;RATE=20;"));
+    CHECK(request.type() == RequestType::Test);
+    CHECK(request.command() == TestCommand::Start);
+    int value = 0;
+    CHECK(request.get_int(kKeyDuration, value) && value == 60);
+    CHECK(request.get_int(kKeyRate, value) && value == 20); // the last occurrence wins
+    std::string_view text;
+    CHECK(request.get(kKeyFormat, text) && text == "BIN");
+    CHECK(!request.has(kKeyBatch));
+
+    CHECK(request.parse("ID;") && request.type() == RequestType::Id && request.command() == TestCommand::None);
+    CHECK(request.parse("STATS") && request.type() == RequestType::Stats);
+    CHECK(request.parse("TEST;CMD=REWIND;") && request.command() == TestCommand::Unknown);
+    CHECK(request.parse("PING;") && request.type() == RequestType::Unknown);
+    CHECK(!request.parse(""));
+    CHECK(!request.parse("TEST;CMD"));
+    std::string crowded = "TEST;";
+    for (size_t i = 0; i <= Request::kMaxFields; i++)
+    {
+        crowded += "K" + std::to_string(i) + "=1;";
+    }
+    CHECK(!request.parse(crowded));
+}
+
+// Splits a text frame list ("1,2,3") into its numbers; TIME values ("1.250") come back in ms
+static std::vector<int64_t> parse_list(std::string_view text, bool seconds = false)
+{
+    std::vector<int64_t> values;
+    while (!text.empty())
+    {
+        size_t comma = text.find(',');
+        std::string_view item = text.substr(0, comma);
+        int64_t value = 0;
+        const char *end = item.data() + item.size();
+        std::from_chars_result result = std::from_chars(item.data(), end, value);
+        if (seconds && result.ptr != end && *result.ptr == '.')
+        {
+            int64_t millis = 0;
+            std::from_chars(result.ptr + 1, end, millis);
+            value = value * 1000 + millis;
+        }
+        values.push_back(value);
+        text = comma == std::string_view::npos ? std::string_view() : text.substr(comma + 1);
+    }
+    return values;
+}
+
+// Fills batch with count readings of test values: channel c of reading i reads 1000 * c + i mV and 10 * c + i mA
+static void fill_batch(SampleBatch &batch, size_t count, int64_t rate_ms)
+{
+    batch.allocate();
+    batch.clear();
+    for (size_t i = 0; i < count; i++)
+    {
+        int32_t mv[Device::kMaxChannels], ma[Device::kMaxChannels];
+        for (size_t c = 0; c < batch.channels; c++)
+        {
+            mv[c] = static_cast<int32_t>(1000 * c + i);
+            ma[c] = static_cast<int32_t>(10 * c + i);
+        }
+        batch.push(static_cast<int64_t>(i) * rate_ms + 1250, mv, ma, 1700000000000000000 + static_cast<int64_t>(i));
+    }
+}
+
+// Text STATUS frames parse back into the readings, times, sequence and stamps they were encoded from
+static void check_text_round_trip()
+{
+    for (size_t channels : {size_t{1}, size_t{3}})
+    {
+        SampleBatch batch(channels);
+        size_t count = channels == 1 ? SampleBatch::max_text(1, true) : 5;
+        fill_batch(batch, count, 10);
+        FrameClock clock;
+        clock.unit = ClockUnit::Nano;
+        clock.has_transmitted = true;
+        clock.transmitted_sequence = 41;
+        clock.transmitted_time = 1700000000123456789;
+        std::string payload;
+        DeviceServerCheck::encode(batch, FrameFormat::Text, 42, 0, clock, [&](const auto &frame)
+                                  { CHECK(frame.ok()); payload = std::string(frame.view()); });
+
+        Request status;
+        CHECK(status.parse(payload));
+        std::string_view text;
+        int sequence = 0;
+        CHECK(status.get_int(kKeySeq, sequence) && sequence == 42);
+        CHECK(status.get(kKeyTime, text));
+        std::vector<int64_t> times = parse_list(text, true);
+        CHECK(times.size() == count);
+        for (size_t i = 0; i < times.size() && i < count; i++)
+        {
+            CHECK(times[i] == batch.time_ms[i]);
+        }
+        CHECK(status.get(kKeyTimestamps, text) && parse_list(text) == std::vector<int64_t>(batch.timestamps.begin(), batch.timestamps.begin() + count));
+        CHECK(status.get(kKeyTransmitted, text) && (parse_list(text) == std::vector<int64_t>{41, 1700000000123456789}));
+        for (size_t c = 0; c < channels; c++)
+        {
+            std::string suffix = channels == 1 ? "" : std::to_string(c);
+            std::string_view mv, ma;
+            CHECK(status.get("MV" + suffix, mv) && status.get("MA" + suffix, ma));
+            std::vector<int64_t> expected_mv(batch.millivolts_column(c), batch.millivolts_column(c) + count);
+            std::vector<int64_t> expected_ma(batch.milliamps_column(c), batch.milliamps_column(c) + count);
+            CHECK(parse_list(mv) == expected_mv);
+            CHECK(parse_list(ma) == expected_ma);
+        }
+    }
+}
+
+static uint32_t load_u16(const uint8_t *in) { return static_cast<uint32_t>(in[0] | in[1] << 8); }
+static uint32_t load_u32(const uint8_t *in) { return load_u16(in) | load_u16(in + 2) << 16; }
+static int64_t load_u64(const uint8_t *in) { return static_cast<int64_t>(load_u32(in) | uint64_t{load_u32(in + 4)} << 32); }
+
+// Binary STATUS frames decode, by the layout in the ReadMe, into what they were encoded from
+static void check_binary_round_trip()
+{
+    for (size_t channels : {size_t{1}, size_t{4}})
+    {
+        SampleBatch batch(channels);
+        size_t count = SampleBatch::max_binary(channels, true);
+        fill_batch(batch, count, 1);
+        FrameClock clock;
+        clock.unit = ClockUnit::Micro;
+        clock.has_transmitted = true;
+        clock.transmitted_sequence = 6;
+        clock.transmitted_time = 1700000000123456;
+        std::string payload;
+        DeviceServerCheck::encode(batch, FrameFormat::Binary, 7, BinaryFrameEncoder::kFlagReplay, clock, [&](const auto &frame)
+                                  { CHECK(frame.ok()); payload = std::string(frame.view()); });
+
+        const uint8_t *frame = reinterpret_cast<const uint8_t *>(payload.data());
+        CHECK(payload.size() == BinaryFrameEncoder::kHeaderSize + count * (BinaryFrameEncoder::channel_sample_size(channels) + 8) +
+                                    BinaryFrameEncoder::kTransmittedSize);
+        CHECK(frame[0] == BinaryFrameEncoder::kMarker && frame[1] == BinaryFrameEncoder::kVersion);
+        CHECK(frame[2] == (channels == 1 ? BinaryFrameEncoder::kKindStatus : BinaryFrameEncoder::kKindChannels));
+        CHECK(frame[3] == (BinaryFrameEncoder::kFlagReplay | BinaryFrameEncoder::kFlagTimestamps | BinaryFrameEncoder::kFlagTransmitted));
+        CHECK(load_u32(frame + 4) == 7);
+        CHECK(load_u16(frame + 8) == count);
+        const uint8_t *body = frame + BinaryFrameEncoder::kHeaderSize;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (channels == 1)
+            {
+                // time, MV, MA per sample
+                const uint8_t *sample = body + i * BinaryFrameEncoder::kSampleSize;
+                CHECK(load_u32(sample) == batch.time_ms[i]);
+                CHECK(static_cast<int16_t>(load_u16(sample + 4)) == batch.millivolts[i]);
+                CHECK(static_cast<int16_t>(load_u16(sample + 6)) == batch.milliamps[i]);
+                continue;
+            }
+            // a column of times, then one column per channel of MV, then of MA
+            CHECK(load_u16(frame + 10) == channels);
+            CHECK(load_u32(body + 4 * i) == batch.time_ms[i]);
+            for (size_t c = 0; c < channels; c++)
+            {
+                const uint8_t *mv = body + 4 * count + 2 * (c * count + i);
+                const uint8_t *ma = body + 4 * count + 2 * ((channels + c) * count + i);
+                CHECK(static_cast<int16_t>(load_u16(mv)) == batch.millivolts_column(c)[i]);
+                CHECK(static_cast<int16_t>(load_u16(ma)) == batch.milliamps_column(c)[i]);
+            }
+        }
+        const uint8_t *stamps = body + count * BinaryFrameEncoder::channel_sample_size(channels);
+        for (size_t i = 0; i < count; i++)
+        {
+            CHECK(load_u64(stamps + 8 * i) == batch.timestamps[i]);
+        }
+        const uint8_t *transmitted = stamps + 8 * count;
+        CHECK(load_u32(transmitted) == 6 && load_u64(transmitted + 4) == 1700000000123456);
+    }
+}
+
+// The SPSC ring hands values over in order, refuses to overfill, and does so across two threads
+static void check_spsc_ring()
+{
+    SpscRing<int, 8> ring;
+    int value = -1;
+    CHECK(!ring.pop(value));
+    for (int i = 0; i < 8; i++)
+    {
+        CHECK(ring.push(i));
+    }
+    CHECK(!ring.push(8));
+    for (int i = 0; i < 8; i++)
+    {
+        CHECK(ring.pop(value) && value == i);
+    }
+    CHECK(!ring.pop(value));
+
+    constexpr uint64_t kValues = 100000;
+    SpscRing<uint64_t, 64> shared;
+    std::thread producer([&]
+                         {
+        for (uint64_t i = 0; i < kValues;)
+        {
+            if (shared.push(i))
+            {
+                i++;
+            }
+            else
+            {
+                std::this_thread::yield(); // full: let the consumer catch up, even on one core
+            }
+        } });
+    uint64_t expected = 0;
+    bool in_order = true;
+    while (expected < kValues)
+    {
+        uint64_t received;
+        if (shared.pop(received))
+        {
+            in_order = in_order && received == expected;
+            expected++;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(in_order);
+}
+
+// The retransmit ring keeps exactly the last kFrames frames, byte for byte
+static void check_retransmit_ring()
+{
+    RetransmitRing ring;
+    CHECK(ring.begin() == 0 && ring.end() == 0);
+    uint32_t total = RetransmitRing::kFrames + 44;
+    for (uint32_t sequence = 0; sequence < total; sequence++)
+    {
+        ring.store(sequence, "FRAME" + std::to_string(sequence));
+    }
+    CHECK(ring.begin() == 44 && ring.end() == total);
+    CHECK(ring.frame(44) == "FRAME44");
+    CHECK(ring.frame(total - 1) == "FRAME" + std::to_string(total - 1));
+    ring.clear();
+    CHECK(ring.begin() == 0 && ring.end() == 0);
+}
+
+// A capture records every reading due within its capacity and reads each back into a batch
+static void check_capture_file()
+{
+    char directory[] = "/tmp/selftest-XXXXXX";
+    if (mkdtemp(directory) == nullptr)
+    {
+        CHECK(!"mkdtemp failed");
+        return;
+    }
+    std::string path = std::string(directory) + "/capture.cap";
+    Device device("check_model", 7, 3);
+    CaptureFile capture;
+    CHECK(capture.create(path, device, std::chrono::milliseconds{5}, 100));
+    for (size_t i = 0; i <= 100; i++)
+    {
+        int32_t mv[3], ma[3];
+        for (size_t c = 0; c < 3; c++)
+        {
+            mv[c] = static_cast<int32_t>(1000 * c + i);
+            ma[c] = static_cast<int32_t>(10 * c + i);
+        }
+        if (i != 10)
+        {
+            capture.record(static_cast<int64_t>(i) * 5, mv, ma); // reading 10 is missed, 100 is past the capacity
+        }
+    }
+    CHECK(capture.count() == 100);
+
+    SampleBatch batch(3);
+    batch.allocate();
+    CHECK(!capture.read(10, batch));
+    CHECK(!capture.read(100, batch));
+    for (size_t i = 0; i < 100; i++)
+    {
+        if (i == 10)
+        {
+            continue;
+        }
+        batch.clear();
+        CHECK(capture.read(i, batch) && batch.count == 1);
+        CHECK(batch.time_ms[0] == static_cast<int64_t>(i) * 5);
+        for (size_t c = 0; c < 3; c++)
+        {
+            CHECK(batch.millivolts_column(c)[0] == static_cast<int32_t>(1000 * c + i));
+            CHECK(batch.milliamps_column(c)[0] == static_cast<int32_t>(10 * c + i));
+        }
+    }
+    capture.finish();
+    unlink(path.c_str());
+    rmdir(directory);
+}
+
+int main()
+{
+    Logger::instance().set_level(LogLevel::Error);
+    check_wheel_boundary_cascade();
+    check_wheel_periodic();
+    check_wheel_order();
+    check_text_frames_fit();
+    check_request_parse();
+    check_text_round_trip();
+    check_binary_round_trip();
+    check_spsc_ring();
+    check_retransmit_ring();
+    check_capture_file();
+    if (g_failures != 0)
+    {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}